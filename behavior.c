@@ -0,0 +1,461 @@
+//============================================================================
+//		Platform behaviors
+// Flies each stream's platform through a scripted sortie instead of a fixed
+// position or orbit, e.g.
+//   -A "takeoff=1500,goto=44.70:-93.10,loiter=600:2000,rtb,repeat"
+// Steps, in order:
+// takeoff=<m>: climb over the launch point to the altitude
+// goto=<lat>:<lon>[:<m>]: transit to the point, climbing or descending to
+//   the altitude if given
+// loiter=<s>:<m>: circle clockwise with the radius for s seconds, 0 = until
+//   recalled
+// rtb: return to the launch point and land, ending the sortie
+// Settings: speed=<m/s> (ground speed, default 40), climb=<m/s> (default 5),
+// stagger=<s> (stream k launches k * s after the start), spacing=<m> (stream
+// k's launch point and waypoints are k * m east of the given ones), repeat
+// (fly the sortie again after landing, unless it took no time). A platform
+// that runs out of steps holds its last position. SIGUSR1 recalls every
+// platform: airborne ones return and land, ones waiting to launch stay on
+// the ground.
+//
+// Each platform's sortie is a stackless coroutine: behaviorMission() is
+// written top to bottom and suspends with BEHAVIOR_AWAIT() until a time or
+// an event, keeping its state in its frame rather than on a stack. Frames
+// are carved from one arena at startup, a few hundred bytes each, for the
+// streams the process sends (a worker's own range with -j), and the
+// scheduler keeps the suspended ones in a heap by wake time. Between
+// resumes a platform follows its current leg (a line or a circle), which is
+// evaluated in closed form for each packet, so a resume is only due at the
+// end of a leg or on an event and costs a jump into the switch.
+//
+// Example usage: ./klvgen -j 4 -N 1000 -r 1 -A "stagger=1,takeoff=1200,goto=44.8:-93.0,rtb"
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#define BEHAVIOR_STEP_MAX 32
+
+#define BEHAVIOR_STEP_TAKEOFF 0
+#define BEHAVIOR_STEP_GOTO 1
+#define BEHAVIOR_STEP_LOITER 2
+#define BEHAVIOR_STEP_RTB 3
+
+#define BEHAVIOR_LEG_LINE 0
+#define BEHAVIOR_LEG_CIRCLE 1
+
+#define BEHAVIOR_EVENT_RECALL 1
+
+// Coroutine body, each BEHAVIOR_AWAIT() has to be on its own line. Locals
+// don't survive a suspension, state that must goes in the frame.
+#define BEHAVIOR_BEGIN(f) switch ((f)->resume) { case 0:
+#define BEHAVIOR_AWAIT(f, until, events) do { (f)->resume = __LINE__; (f)->wake = (until); \
+		(f)->waitEvents = (events); return 1; case __LINE__: ; } while (0)
+#define BEHAVIOR_END(f) } (f)->resume = -1; return 0
+
+//============================================================================
+
+// One step of the sortie
+struct behaviorStep {
+	int kind;
+	double lat, lon; // Degrees
+	double alt; // Meters, NAN = keep the altitude
+	double seconds; // Loiter time, 0 = until recalled
+	double radius; // Loiter radius, meters
+};
+
+// What a platform is doing until its next resume. A line runs from the start
+// position to the end position between start and end, a circle is centered
+// on the end position.
+struct behaviorLeg {
+	int kind;
+	uint64_t start; // UNIX microseconds
+	uint64_t end; // UINT64_MAX = open ended
+	double fromLat, fromLon, fromAlt;
+	double toLat, toLon, toAlt;
+	double radius; // Meters
+	double angle; // Radians clockwise from north at start
+	double rate; // Radians per microsecond
+};
+
+// Coroutine frame of one platform
+struct behaviorFrame {
+	int32_t resume; // Line to resume at, 0 = start, -1 = finished
+	int32_t step;
+	int32_t stream;
+	int32_t heapIndex; // -1 when not scheduled
+	uint32_t waitEvents;
+	int32_t recalled;
+	uint64_t wake; // UNIX microseconds
+	uint64_t time; // Time it was resumed at
+	uint64_t launched; // Time the current sortie started
+	double homeLat, homeLon, homeAlt;
+	double east; // Degrees of longitude added to the waypoints
+	double heading; // Degrees, of the last line that went anywhere
+	struct behaviorLeg leg;
+};
+
+struct behaviorStep behaviorSteps[BEHAVIOR_STEP_MAX];
+int behaviorStepCount;
+int behaviorRepeat;
+double behaviorSpeed = 40; // Meters per second
+double behaviorClimb = 5;
+double behaviorStagger; // Seconds
+double behaviorSpacing; // Meters
+int behaviorEnabled; // Set by parseBehavior()
+
+int behaviorPlatforms; // 0 = no behaviors
+int behaviorFirstStream; // Stream of behaviorArena[0]
+struct behaviorFrame *behaviorArena;
+struct behaviorFrame **behaviorHeap;
+int behaviorHeapSize;
+volatile sig_atomic_t behaviorRecall;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Parses a colon separated list of up to count numbers, returns how many
+// there were or -1 if one isn't a number
+int parseBehaviorNumbers(const char *str, double *values, int count) {
+	char *end;
+	int n = 0;
+
+	for (;;) {
+		if (n == count) return -1;
+		values[n++] = strtod(str, &end);
+		if (end == str) return -1;
+		if (*end == '\0') return n;
+		if (*end != ':') return -1;
+		str = end + 1;
+	}
+}
+
+//--------------------------------------------------
+// Parses a comma separated behavior script, returns -1 if it is malformed
+int parseBehavior(const char *str) {
+	char spec[512], *item, *value, *save = NULL;
+	struct behaviorStep *step;
+	double values[3];
+	int n;
+
+	strncpy(spec, str, sizeof(spec));
+	spec[sizeof(spec) - 1] = '\0';
+	for (item = strtok_r(spec, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		value = strchr(item, '=');
+		if (value != NULL) *value++ = '\0';
+		if (strcmp(item, "repeat") == 0) {
+			behaviorRepeat = 1;
+			continue;
+		}
+		step = &behaviorSteps[behaviorStepCount];
+		if (behaviorStepCount < BEHAVIOR_STEP_MAX) step->alt = NAN;
+		if (strcmp(item, "rtb") == 0) {
+			if (behaviorStepCount == BEHAVIOR_STEP_MAX) return -1;
+			step->kind = BEHAVIOR_STEP_RTB;
+			behaviorStepCount++;
+			continue;
+		}
+		if (value == NULL) return -1;
+		n = parseBehaviorNumbers(value, values, 3);
+		if (n == -1) return -1;
+		if (n == 1 && strcmp(item, "speed") == 0 && values[0] > 0) behaviorSpeed = values[0];
+		else if (n == 1 && strcmp(item, "climb") == 0 && values[0] > 0) behaviorClimb = values[0];
+		else if (n == 1 && strcmp(item, "stagger") == 0 && values[0] >= 0) behaviorStagger = values[0];
+		else if (n == 1 && strcmp(item, "spacing") == 0) behaviorSpacing = values[0];
+		else {
+			if (behaviorStepCount == BEHAVIOR_STEP_MAX) return -1;
+			if (strcmp(item, "takeoff") == 0 && n == 1) {
+				step->kind = BEHAVIOR_STEP_TAKEOFF;
+				step->alt = values[0];
+			}
+			else if (strcmp(item, "goto") == 0 && n >= 2) {
+				step->kind = BEHAVIOR_STEP_GOTO;
+				step->lat = values[0];
+				step->lon = values[1];
+				if (n == 3) step->alt = values[2];
+			}
+			else if (strcmp(item, "loiter") == 0 && n == 2 && values[0] >= 0 && values[1] > 0) {
+				step->kind = BEHAVIOR_STEP_LOITER;
+				step->seconds = values[0];
+				step->radius = values[1];
+			}
+			else return -1;
+			behaviorStepCount++;
+		}
+	}
+	behaviorEnabled = 1;
+	return 0;
+}
+
+//--------------------------------------------------
+// Recalls every platform, the batch builder posts the event
+void behaviorHandleRecall(int sig) {
+	behaviorRecall = 1;
+}
+
+//--------------------------------------------------
+// Position of a platform at time t, microseconds
+void behaviorPosition(const struct behaviorFrame *f, uint64_t t, double *lat, double *lon, double *alt) {
+	const struct behaviorLeg *leg = &f->leg;
+	double frac, angle;
+
+	if (leg->kind == BEHAVIOR_LEG_CIRCLE) {
+		angle = leg->angle + (t > leg->start ? (double)(t - leg->start) : 0) * leg->rate;
+		*lat = leg->toLat + leg->radius * cos(angle) / (MOTION_EARTH_RADIUS * MOTION_RADIANS);
+		*lon = leg->toLon + leg->radius * sin(angle) /
+				(MOTION_EARTH_RADIUS * cos(leg->toLat * MOTION_RADIANS) * MOTION_RADIANS);
+		*alt = leg->toAlt;
+		return;
+	}
+	if (t <= leg->start) frac = 0;
+	else if (t >= leg->end) frac = 1;
+	else frac = (double)(t - leg->start) / (leg->end - leg->start);
+	*lat = leg->fromLat + (leg->toLat - leg->fromLat) * frac;
+	*lon = leg->fromLon + (leg->toLon - leg->fromLon) * frac;
+	*alt = leg->fromAlt + (leg->toAlt - leg->fromAlt) * frac;
+}
+
+//--------------------------------------------------
+// Starts a line from where the platform is to the given point, at the
+// ground speed and climb rate, whichever takes longer
+void behaviorLine(struct behaviorFrame *f, double lat, double lon, double alt) {
+	struct behaviorLeg *leg = &f->leg;
+	double north, east, seconds;
+
+	behaviorPosition(f, f->time, &leg->fromLat, &leg->fromLon, &leg->fromAlt);
+	north = (lat - leg->fromLat) * MOTION_EARTH_RADIUS * MOTION_RADIANS;
+	east = (lon - leg->fromLon) * MOTION_EARTH_RADIUS * cos(leg->fromLat * MOTION_RADIANS) * MOTION_RADIANS;
+	seconds = sqrt(north * north + east * east) / behaviorSpeed;
+	if (fabs(alt - leg->fromAlt) / behaviorClimb > seconds) seconds = fabs(alt - leg->fromAlt) / behaviorClimb;
+	if (north != 0 || east != 0) f->heading = atan2(east, north) / MOTION_RADIANS;
+	leg->kind = BEHAVIOR_LEG_LINE;
+	leg->toLat = lat;
+	leg->toLon = lon;
+	leg->toAlt = alt;
+	leg->start = f->time;
+	leg->end = f->time + (uint64_t)(seconds * 1e6);
+}
+
+//--------------------------------------------------
+// Starts a clockwise circle that the platform enters on its current heading,
+// the center is radius meters to its right
+void behaviorCircle(struct behaviorFrame *f, double radius, double seconds) {
+	struct behaviorLeg *leg = &f->leg;
+	double lat, lon, alt, right = (f->heading + 90) * MOTION_RADIANS;
+
+	behaviorPosition(f, f->time, &lat, &lon, &alt);
+	leg->kind = BEHAVIOR_LEG_CIRCLE;
+	leg->toLat = lat + radius * cos(right) / (MOTION_EARTH_RADIUS * MOTION_RADIANS);
+	leg->toLon = lon + radius * sin(right) / (MOTION_EARTH_RADIUS * cos(lat * MOTION_RADIANS) * MOTION_RADIANS);
+	leg->toAlt = alt;
+	leg->radius = radius;
+	leg->angle = right + M_PI;
+	leg->rate = behaviorSpeed / radius / 1e6;
+	leg->start = f->time;
+	leg->end = seconds > 0 ? f->time + (uint64_t)(seconds * 1e6) : UINT64_MAX;
+}
+
+//--------------------------------------------------
+// A platform's sortie, resumed by behaviorRun(). Returns 1 when it suspends,
+// 0 when it is finished.
+int behaviorMission(struct behaviorFrame *f) {
+	const struct behaviorStep *step;
+	double lat, lon, alt;
+
+	BEHAVIOR_BEGIN(f);
+	behaviorLine(f, f->homeLat, f->homeLon, f->homeAlt);
+	BEHAVIOR_AWAIT(f, f->time + (uint64_t)(behaviorStagger * f->stream * 1e6), BEHAVIOR_EVENT_RECALL);
+	while (!f->recalled) {
+		f->launched = f->time;
+		for (f->step = 0; f->step < behaviorStepCount; ++f->step) {
+			step = &behaviorSteps[f->step];
+			if (step->kind == BEHAVIOR_STEP_RTB) break;
+			behaviorPosition(f, f->time, &lat, &lon, &alt);
+			if (step->kind == BEHAVIOR_STEP_TAKEOFF) behaviorLine(f, lat, lon, step->alt);
+			else if (step->kind == BEHAVIOR_STEP_GOTO)
+				behaviorLine(f, step->lat, step->lon + f->east, isnan(step->alt) ? alt : step->alt);
+			else behaviorCircle(f, step->radius, step->seconds);
+			BEHAVIOR_AWAIT(f, f->leg.end, BEHAVIOR_EVENT_RECALL);
+			if (f->recalled) break;
+		}
+		if (f->step == behaviorStepCount) {
+			// Out of steps, hold until recalled
+			behaviorPosition(f, f->time, &lat, &lon, &alt);
+			behaviorLine(f, lat, lon, alt);
+			BEHAVIOR_AWAIT(f, UINT64_MAX, BEHAVIOR_EVENT_RECALL);
+		}
+		// Home at the altitude it is at, then down
+		behaviorPosition(f, f->time, &lat, &lon, &alt);
+		behaviorLine(f, f->homeLat, f->homeLon, alt);
+		BEHAVIOR_AWAIT(f, f->leg.end, 0);
+		behaviorLine(f, f->homeLat, f->homeLon, f->homeAlt);
+		BEHAVIOR_AWAIT(f, f->leg.end, 0);
+		// A sortie that took no time would repeat forever at the same instant
+		if (!behaviorRepeat || f->time == f->launched) break;
+	}
+	BEHAVIOR_END(f);
+}
+
+//--------------------------------------------------
+// Moves a scheduled frame towards the top of the heap while it wakes earlier
+void behaviorSiftUp(struct behaviorFrame *f) {
+	struct behaviorFrame *parent;
+	int i = f->heapIndex;
+
+	while (i > 0 && (parent = behaviorHeap[(i - 1) / 2])->wake > f->wake) {
+		behaviorHeap[i] = parent;
+		parent->heapIndex = i;
+		i = (i - 1) / 2;
+	}
+	behaviorHeap[i] = f;
+	f->heapIndex = i;
+}
+
+//--------------------------------------------------
+// Removes and returns the frame that wakes first
+struct behaviorFrame *behaviorPop(void) {
+	struct behaviorFrame *top = behaviorHeap[0], *last = behaviorHeap[--behaviorHeapSize], *child;
+	int i = 0, c;
+
+	while ((c = 2 * i + 1) < behaviorHeapSize) {
+		if (c + 1 < behaviorHeapSize && behaviorHeap[c + 1]->wake < behaviorHeap[c]->wake) c++;
+		child = behaviorHeap[c];
+		if (child->wake >= last->wake) break;
+		behaviorHeap[i] = child;
+		child->heapIndex = i;
+		i = c;
+	}
+	if (behaviorHeapSize > 0) {
+		behaviorHeap[i] = last;
+		last->heapIndex = i;
+	}
+	top->heapIndex = -1;
+	return top;
+}
+
+//--------------------------------------------------
+// Resumes every frame due by now, in wake order
+void behaviorRun(uint64_t now) {
+	struct behaviorFrame *f;
+
+	while (behaviorHeapSize > 0 && behaviorHeap[0]->wake <= now) {
+		f = behaviorPop();
+		f->time = f->wake;
+		if (behaviorMission(f)) {
+			f->heapIndex = behaviorHeapSize++;
+			behaviorSiftUp(f);
+		}
+	}
+}
+
+//--------------------------------------------------
+// Wakes every frame waiting for the event at time now. A recall reaches
+// every sortie still running, so one already on its way home doesn't repeat.
+void behaviorPost(uint32_t event, uint64_t now) {
+	struct behaviorFrame *f;
+	int i;
+
+	for (i = 0; i < behaviorPlatforms; ++i) {
+		f = &behaviorArena[i];
+		if (f->resume == -1) continue;
+		if (event == BEHAVIOR_EVENT_RECALL) f->recalled = 1;
+		if (f->heapIndex < 0 || !(f->waitEvents & event)) continue;
+		if (f->wake > now) {
+			f->wake = now;
+			behaviorSiftUp(f);
+		}
+	}
+}
+
+//--------------------------------------------------
+// Checks the behaviors against the other options, call after exprInit().
+// Returns -1 if they can't be used.
+int behaviorCheck(int streams) {
+	int i;
+
+	if (!behaviorEnabled) return 0;
+	if (motionLength > 0) {
+		printf("ERROR: The orbit and behaviors both fly the platform, use loiter for an orbit\n");
+		return -1;
+	}
+	for (i = 0; i < exprFieldCount; ++i) {
+		if (exprFields[i].kind <= EXPR_FIELD_ALTITUDE) {
+			printf("ERROR: Behaviors drive lat, lon and alt, they can't also have expressions\n");
+			return -1;
+		}
+	}
+	printf("Behaviors: %d platforms, %d steps, %d bytes per coroutine frame\n", streams, behaviorStepCount,
+			(int)sizeof(struct behaviorFrame));
+	return 0;
+}
+
+//--------------------------------------------------
+// Sets up a frame for each of the process's streams, first to first +
+// streams - 1, launching from the configured position now. Returns -1 if
+// the frames can't be allocated.
+int behaviorInit(int first, int streams) {
+	struct behaviorFrame *f;
+	uint64_t now;
+	int i;
+
+	if (!behaviorEnabled) return 0;
+	behaviorArena = calloc(streams, sizeof(*behaviorArena));
+	behaviorHeap = malloc(sizeof(*behaviorHeap) * streams);
+	if (behaviorArena == NULL || behaviorHeap == NULL) {
+		printf("ERROR: Unable to allocate behavior frames\n");
+		return -1;
+	}
+	now = updateTimestamp();
+	for (i = 0; i < streams; ++i) {
+		f = &behaviorArena[i];
+		f->stream = first + i;
+		f->east = behaviorSpacing * f->stream / (MOTION_EARTH_RADIUS * cos(latitudeDegrees * MOTION_RADIANS) * MOTION_RADIANS);
+		f->homeLat = f->leg.fromLat = f->leg.toLat = latitudeDegrees;
+		f->homeLon = f->leg.fromLon = f->leg.toLon = longitudeDegrees + f->east;
+		f->homeAlt = f->leg.fromAlt = f->leg.toAlt = altitudeMeters;
+		f->wake = now;
+		f->heapIndex = i; // All wake together, already a heap
+		behaviorHeap[i] = f;
+	}
+	behaviorFirstStream = first;
+	behaviorPlatforms = behaviorHeapSize = streams;
+	signal(SIGUSR1, behaviorHandleRecall);
+	return 0;
+}
+
+//--------------------------------------------------
+// Writes each packet's platform position, as for exprApplyBatch(). Frames
+// due by a packet's time are resumed first.
+void behaviorApplyBatch(unsigned char **slots, const uint64_t *times, const int *streams, uint16_t *sums, int count) {
+	double lat, lon, alt;
+	uint32_t netLat, netLon;
+	uint16_t netAlt;
+	unsigned char *buff;
+	int i;
+
+	// A recall waits for a batch with a time to post it at
+	if (count == 0) return;
+	if (behaviorRecall) {
+		behaviorRecall = 0;
+		behaviorPost(BEHAVIOR_EVENT_RECALL, times[0]);
+	}
+	for (i = 0; i < count; ++i) {
+		if (behaviorHeapSize > 0 && behaviorHeap[0]->wake <= times[i]) behaviorRun(times[i]);
+		behaviorPosition(&behaviorArena[streams != NULL ? streams[i] - behaviorFirstStream : 0], times[i], &lat, &lon, &alt);
+		if (lon > 180) lon -= 360;
+		if (lon < -180) lon += 360;
+		if (alt < -900) alt = -900;
+		if (alt > 19000) alt = 19000;
+		netLat = htonl((uint32_t)mapSigned(lat, 90, 2147483647));
+		netLon = htonl((uint32_t)mapSigned(lon, 180, 2147483647));
+		netAlt = htons((uint16_t)floor((alt + 900) / 19900 * 65535 + 0.5));
+
+		// Tags 13, 14 and 15 are consecutive items from motionOffset
+		buff = &slots[i][motionOffset];
+		if (sums != NULL) sums[i] -= sumBytesAt(buff, 16, motionOffset);
+		memcpy(&buff[2], &netLat, 4);
+		memcpy(&buff[8], &netLon, 4);
+		memcpy(&buff[14], &netAlt, 2);
+		if (sums != NULL) sums[i] += sumBytesAt(buff, 16, motionOffset);
+	}
+}
@@ -0,0 +1,207 @@
+//============================================================================
+//		Transport calibration
+// Picks the batch send path for this host at startup, so operators don't
+// have to know which one its kernel and NIC favor. -U auto floods through
+// each candidate for CALIBRATE_TIME:
+// sendto: one system call per packet
+// sendmmsg: one system call per batch of 8, 16, 32 or 64 packets
+// gso: UDP generic segmentation offload, one send per batch split into
+//   datagrams by the kernel, when the kernel and route support it and all
+//   packets go to one destination at one length (not replay)
+// and measures packets per second and CPU time (user and system) per
+// packet. The candidate with the least CPU that reaches the target rate
+// (-r, or -B over the packet's wire size, per worker with -j; none when
+// flooding) is selected, or the fastest if none reaches it. The table and
+// the decision are logged.
+//
+// auto floods the configured destination; auto:null sends to a local socket
+// that is never read instead, measuring the sending side alone. The
+// benchmark has its own socket, so the stream's socket and its transmit
+// timestamps are untouched. A single paced stream sends one packet per
+// tick, so the choice applies to floods, bit rates, replay, workers and
+// daemon jobs. XDP (-x) is chosen by the operator and isn't calibrated.
+//
+// Example usage: ./klvgen -U auto:null -r 0 -a 10.0.0.2 -p 9000
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifdef __gnu_linux__
+
+#define CALIBRATE_TIME 100000000ULL // Nanoseconds per candidate
+#define CALIBRATE_CANDIDATES 9
+
+//============================================================================
+
+// A send path under test and its results
+struct transportCandidate {
+	int transport;
+	int batch;
+	int available;
+	double rate; // Packets per second
+	double cpu; // Nanoseconds of CPU per packet
+};
+
+int calibrateMode; // 0 = off, 1 = against the destination, 2 = against a null sink
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Parses a transport name with an optional batch size, e.g. sendmmsg:16, or
+// auto[:null]. Returns -1 if it isn't one.
+int parseTransport(const char *str) {
+	const char *batch = strchr(str, ':');
+	size_t len = batch != NULL ? (size_t)(batch - str) : strlen(str);
+
+	if (len == 4 && strncmp(str, "auto", 4) == 0) {
+		if (batch != NULL && strcmp(batch, ":null") != 0) return -1;
+		calibrateMode = batch != NULL ? 2 : 1;
+		return 0;
+	}
+	if (len == 6 && strncmp(str, "sendto", 6) == 0) sendTransport = TRANSPORT_SENDTO;
+	else if (len == 8 && strncmp(str, "sendmmsg", 8) == 0) sendTransport = TRANSPORT_SENDMMSG;
+	else if (len == 3 && strncmp(str, "gso", 3) == 0) sendTransport = TRANSPORT_GSO;
+	else return -1;
+	if (batch != NULL) {
+		sendBatch = atoi(&batch[1]);
+		if (sendBatch < 1 || sendBatch > PACKET_BATCH_MAX) return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Name of a transport for the log
+const char *transportName(int transport) {
+	return transport == TRANSPORT_SENDTO ? "sendto" : transport == TRANSPORT_GSO ? "gso" : "sendmmsg";
+}
+
+//--------------------------------------------------
+// CPU time used by the process so far, nanoseconds
+uint64_t cpuNanoseconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//--------------------------------------------------
+// Floods through one candidate and records its rate and CPU cost
+void calibrateCandidate(struct transportCandidate *candidate) {
+	uint64_t times[PACKET_BATCH_MAX];
+	uint64_t start, cpuStart, now, packets = 0;
+	int i;
+
+	sendTransport = candidate->transport;
+	sendBatch = candidate->batch;
+	start = monotonicNanoseconds();
+	cpuStart = cpuNanoseconds();
+	do {
+		now = updateTimestamp();
+		for (i = 0; i < sendBatch; ++i) times[i] = now;
+		makePacketBatch(packetPoolSlots, times, NULL, sendBatch);
+		if (udpSendBatch(packetPoolSlots, NULL, sendBatch) == -1) return;
+		packets += sendBatch;
+		now = monotonicNanoseconds();
+	} while (now - start < CALIBRATE_TIME);
+	candidate->available = 1;
+	candidate->rate = packets * 1e9 / (now - start);
+	candidate->cpu = (double)(cpuNanoseconds() - cpuStart) / packets;
+}
+
+//--------------------------------------------------
+// Benchmarks the candidates and selects sendTransport and sendBatch, returns
+// -1 if the benchmark socket can't be opened
+int calibrateRun(void) {
+	struct transportCandidate candidates[CALIBRATE_CANDIDATES] = {
+		{TRANSPORT_SENDTO, PACKET_BATCH_MAX},
+		{TRANSPORT_SENDMMSG, 8}, {TRANSPORT_SENDMMSG, 16}, {TRANSPORT_SENDMMSG, 32}, {TRANSPORT_SENDMMSG, 64},
+		{TRANSPORT_GSO, 8}, {TRANSPORT_GSO, 16}, {TRANSPORT_GSO, 32}, {TRANSPORT_GSO, 64}
+	};
+	struct transportCandidate *best = NULL, *candidate;
+	struct sockaddr_in savedAddr = servaddr, sink;
+	socklen_t sinkLength = sizeof(sink);
+	int savedSock = sock, savedTxstamp = txstampActive, sinkSock = -1, noGso, segment = packetLength, zero = 0;
+	double target = 0;
+	int i, met = 0;
+
+	if (bitRate > 0) target = (double)bitRate / 8 / wireBytes(packetLength);
+	else if (sendRate > 0) target = sendRate;
+	if (coordWorkers > 0) target = target * (coordStreams > 0 ? coordStreams : coordWorkers) / coordWorkers;
+	// Streams of workers and daemon jobs have their own ports and replayed
+	// packets their own lengths, which GSO can't do
+	noGso = coordWorkers > 0 || daemonSocket[0] != '\0' || replayFile[0] != '\0';
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror("Unable to create calibration socket");
+		sock = savedSock;
+		return -1;
+	}
+	memset(&servaddr, 0, sizeof(servaddr));
+	servaddr.sin_family = AF_INET;
+	servaddr.sin_addr.s_addr = inet_addr(address);
+	servaddr.sin_port = htons(servPort);
+	if (calibrateMode == 2) {
+		// Never read, packets are dropped once its buffer is full
+		memset(&sink, 0, sizeof(sink));
+		sink.sin_family = AF_INET;
+		sink.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		sinkSock = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sinkSock < 0 || bind(sinkSock, (struct sockaddr *)&sink, sizeof(sink)) != 0 ||
+				getsockname(sinkSock, (struct sockaddr *)&servaddr, &sinkLength) != 0) {
+			perror("Unable to open calibration sink");
+			if (sinkSock >= 0) close(sinkSock);
+			close(sock);
+			sock = savedSock;
+			servaddr = savedAddr;
+			return -1;
+		}
+		setsockopt(sinkSock, SOL_SOCKET, SO_RCVBUF, &zero, sizeof(zero));
+	}
+	txstampActive = 0;
+
+	printf("Calibrating transports against %s:%d", inet_ntoa(servaddr.sin_addr), ntohs(servaddr.sin_port));
+	if (target > 0) printf(" for %.0f packets/s\n", target);
+	else printf(" for the highest rate\n");
+	for (i = 0; i < CALIBRATE_CANDIDATES; ++i) {
+		candidate = &candidates[i];
+		// The socket option only probes for support, sends set the size per message
+		if (candidate->transport == TRANSPORT_GSO && (noGso ||
+				setsockopt(sock, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) != 0 ||
+				setsockopt(sock, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) != 0)) {
+			printf("  %-8s x%-2d: unavailable\n", transportName(candidate->transport), candidate->batch);
+			continue;
+		}
+		calibrateCandidate(candidate);
+		if (!candidate->available) {
+			printf("  %-8s x%-2d: unavailable\n", transportName(candidate->transport), candidate->batch);
+			continue;
+		}
+		printf("  %-8s x%-2d: %.0f packets/s, %.2f us CPU per packet\n", transportName(candidate->transport),
+				candidate->batch, candidate->rate, candidate->cpu / 1e3);
+		if (target > 0 && candidate->rate >= target) {
+			if (!met || candidate->cpu < best->cpu) best = candidate;
+			met = 1;
+		}
+		else if (!met && (best == NULL || candidate->rate > best->rate)) best = candidate;
+	}
+
+	if (sinkSock >= 0) close(sinkSock);
+	close(sock);
+	sock = savedSock;
+	servaddr = savedAddr;
+	txstampActive = savedTxstamp;
+	if (best == NULL) {
+		printf("WARNING: No transport could send, keeping sendmmsg x%d\n", PACKET_BATCH_MAX);
+		sendTransport = TRANSPORT_SENDMMSG;
+		sendBatch = PACKET_BATCH_MAX;
+		return 0;
+	}
+	sendTransport = best->transport;
+	sendBatch = best->batch;
+	printf("Transport: %s x%d, %s\n", transportName(sendTransport), sendBatch,
+			met ? "the least CPU reaching the target" : target > 0 ? "the fastest, none reach the target" : "the fastest");
+	fflush(stdout);
+	return 0;
+}
+#endif
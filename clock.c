@@ -0,0 +1,185 @@
+//============================================================================
+//		Platform clock models
+// Gives each stream its own misbehaving clock for the embedded timestamps,
+// so synchronizers downstream can be tested against offset and drifting
+// platforms instead of the host's CLOCK_REALTIME. A model combines:
+// offset=<ms>: fixed offset
+// drift=<ppm>: linear drift from the start of the stream
+// walk=<us>: random walk, standard deviation after one second
+// step=<s>:<ms>: jumps of the given size at random intervals averaging s
+// seed=<n>: seed of the per-stream random sequences (default 1)
+// e.g. -K offset=~500,drift=~50,walk=20,step=60:~100. A value prefixed by ~
+// is a range: each stream draws its own uniformly from -value to +value (0
+// to value for walk), and each jump draws its size. Without ~ every stream
+// gets the value as given. Stream k's sequence only depends on the seed and
+// k, so runs and workers are reproducible.
+//
+// The batch builders pass each packet's host time through clockModelTime()
+// with its stream. The common case is an add and a multiply; random walk
+// steps (every CLOCK_WALK_INTERVAL) and jumps are taken only when due.
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#define CLOCK_WALK_INTERVAL 100000ULL // Microseconds between random walk steps
+
+//============================================================================
+
+// A model parameter, drawn per stream (or per jump) from +/-value when spread
+struct clockParameter {
+	double value;
+	int spread;
+};
+
+// Clock state of one stream
+struct clockModel {
+	int64_t offset; // Microseconds, the fixed offset plus the jumps so far
+	int64_t drift; // Parts per billion
+	double walk; // Microseconds walked so far
+	double walkStep; // Standard deviation of one walk step, microseconds
+	uint64_t walkTime; // Host microseconds of the next walk step, UINT64_MAX = none
+	uint64_t stepTime; // Host microseconds of the next jump, UINT64_MAX = none
+	uint64_t nextEvent; // Earlier of the two
+	uint64_t random;
+};
+
+struct clockParameter clockOffset; // Milliseconds
+struct clockParameter clockDrift; // Parts per million
+struct clockParameter clockWalk; // Microseconds per root second
+struct clockParameter clockStepInterval; // Seconds, 0 = no jumps
+struct clockParameter clockStepSize; // Milliseconds
+uint64_t clockSeed = 1;
+int clockEnabled; // Set by parseClockModel()
+struct clockModel *clockModels; // NULL = host clock
+uint64_t clockEpoch; // Host microseconds the drift is counted from
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Parses a value with an optional ~ range prefix, returns -1 if it isn't a number
+int parseClockParameter(const char *str, struct clockParameter *parameter) {
+	char *end;
+	parameter->spread = str[0] == '~';
+	parameter->value = strtod(&str[parameter->spread], &end);
+	return end == &str[parameter->spread] || *end != '\0' ? -1 : 0;
+}
+
+//--------------------------------------------------
+// Parses a comma separated clock model, returns -1 if it is malformed
+int parseClockModel(const char *str) {
+	char spec[256], *item, *value, *size, *save = NULL;
+
+	strncpy(spec, str, sizeof(spec));
+	spec[sizeof(spec) - 1] = '\0';
+	for (item = strtok_r(spec, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		value = strchr(item, '=');
+		if (value == NULL) return -1;
+		*value++ = '\0';
+		if (strcmp(item, "offset") == 0) {
+			if (parseClockParameter(value, &clockOffset) == -1) return -1;
+		}
+		else if (strcmp(item, "drift") == 0) {
+			if (parseClockParameter(value, &clockDrift) == -1) return -1;
+		}
+		else if (strcmp(item, "walk") == 0) {
+			if (parseClockParameter(value, &clockWalk) == -1 || clockWalk.value < 0) return -1;
+		}
+		else if (strcmp(item, "step") == 0) {
+			size = strchr(value, ':');
+			if (size == NULL) return -1;
+			*size++ = '\0';
+			if (parseClockParameter(value, &clockStepInterval) == -1 || clockStepInterval.spread ||
+					clockStepInterval.value <= 0 || parseClockParameter(size, &clockStepSize) == -1) return -1;
+		}
+		else if (strcmp(item, "seed") == 0) clockSeed = strtoull(value, NULL, 10);
+		else return -1;
+	}
+	clockEnabled = 1;
+	return 0;
+}
+
+//--------------------------------------------------
+// Next number of a stream's sequence (splitmix64)
+uint64_t clockRandom(struct clockModel *model) {
+	uint64_t z = (model->random += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+//--------------------------------------------------
+// Uniform in [0, 1)
+double clockUniform(struct clockModel *model) {
+	return (clockRandom(model) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//--------------------------------------------------
+// Draws a parameter for a stream or jump
+double clockDraw(struct clockModel *model, const struct clockParameter *parameter) {
+	return parameter->spread ? parameter->value * (2 * clockUniform(model) - 1) : parameter->value;
+}
+
+//--------------------------------------------------
+// Microseconds to the next jump, exponentially distributed
+uint64_t clockNextStep(struct clockModel *model) {
+	return (uint64_t)(-log(1 - clockUniform(model)) * clockStepInterval.value * 1e6) + 1;
+}
+
+//--------------------------------------------------
+// Sets up a model for each stream, starting now
+int clockModelInit(int streams) {
+	struct clockModel *model;
+	int i;
+
+	if (!clockEnabled) return 0;
+	clockModels = malloc(sizeof(*clockModels) * streams);
+	if (clockModels == NULL) {
+		printf("ERROR: Unable to allocate clock models\n");
+		return -1;
+	}
+	clockEpoch = updateTimestamp();
+	for (i = 0; i < streams; ++i) {
+		model = &clockModels[i];
+		model->random = clockSeed * 0x100000001B3ULL + i;
+		model->offset = (int64_t)(clockDraw(model, &clockOffset) * 1000);
+		model->drift = (int64_t)(clockDraw(model, &clockDrift) * 1000);
+		model->walk = 0;
+		// Steps of CLOCK_WALK_INTERVAL add up to the given deviation after a second
+		model->walkStep = (clockWalk.spread ? clockWalk.value * clockUniform(model) : clockWalk.value) *
+				sqrt(CLOCK_WALK_INTERVAL / 1e6);
+		model->walkTime = model->walkStep > 0 ? clockEpoch + CLOCK_WALK_INTERVAL : UINT64_MAX;
+		model->stepTime = clockStepInterval.value > 0 ? clockEpoch + clockNextStep(model) : UINT64_MAX;
+		model->nextEvent = model->walkTime < model->stepTime ? model->walkTime : model->stepTime;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Takes the walk steps and jumps due by now
+void clockModelAdvance(struct clockModel *model, uint64_t now) {
+	double gauss;
+	int i;
+
+	while (model->walkTime <= now) {
+		// Sum of uniforms, near enough to normal for a walk
+		for (gauss = -2, i = 0; i < 4; ++i) gauss += clockUniform(model);
+		model->walk += gauss * sqrt(3) * model->walkStep;
+		model->walkTime += CLOCK_WALK_INTERVAL;
+	}
+	while (model->stepTime <= now) {
+		model->offset += (int64_t)(clockDraw(model, &clockStepSize) * 1000);
+		model->stepTime += clockNextStep(model);
+	}
+	model->nextEvent = model->walkTime < model->stepTime ? model->walkTime : model->stepTime;
+}
+
+//--------------------------------------------------
+// A stream's clock reading at host time now, both UNIX microseconds
+uint64_t clockModelTime(int stream, uint64_t now) {
+	struct clockModel *model;
+	if (clockModels == NULL) return now;
+	model = &clockModels[stream];
+	if (now >= model->nextEvent) clockModelAdvance(model, now);
+	return now + model->offset + (int64_t)model->walk + (int64_t)(now - clockEpoch) * model->drift / 1000000000;
+}
@@ -0,0 +1,232 @@
+//============================================================================
+//		Multi-process coordinator
+// Spreads streams over worker processes when one process runs out of
+// sockets, file descriptors or CPU. Stream k is sent to port servPort + k,
+// the streams are split into contiguous ranges, one per worker.
+//
+// The coordinator maps a shared segment before forking that holds each
+// worker's stream range, a start barrier and each worker's counters. Every
+// worker owns one cache line of counters and is the only writer to it, so
+// nothing is locked across processes; the coordinator only reads them.
+// Workers report ready, then wait for the coordinator to publish a common
+// start time, so all streams tick together from the first packet. The
+// coordinator prints an aggregate report every second and a final one with
+// each worker's share when the workers exit or it is interrupted.
+//
+// Example usage: ./klvgen -j 4 -N 64 -r 30 -a 127.0.0.1 -p 9000
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define COORD_WORKER_MAX 256
+#define COORD_STREAM_MAX 4096
+#define COORD_READY_TIMEOUT 5000 // Milliseconds for the workers to report ready
+#define COORD_START_LEAD 100000000ULL // Nanoseconds from the last worker ready to the first packet
+#define COORD_REPORT_INTERVAL 1000000000ULL
+
+//============================================================================
+
+// Counters of one worker, alone on a cache line
+struct coordWorkerStats {
+	uint64_t packets;
+	uint64_t errors;
+	uint64_t lateTicks; // Ticks sent more than half a period after their deadline
+	int32_t pid;
+	int32_t firstStream;
+	int32_t streamCount;
+} __attribute__((aligned(64)));
+
+// Shared segment, mapped by the coordinator before forking
+struct coordSegment {
+	int32_t workers;
+	int32_t streams;
+	int32_t ready; // Workers waiting for startTime
+	uint64_t startTime; // Monotonic nanoseconds of the first tick, 0 until all are ready
+	struct coordWorkerStats stats[COORD_WORKER_MAX];
+};
+
+int coordWorkers; // 0 = run in this process
+int coordStreams;
+struct coordSegment *coordShared;
+volatile sig_atomic_t coordStop;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Stops the report loop, the workers get the signal from the terminal or
+// from coordRun()
+void coordHandleSignal(int sig) {
+	coordStop = 1;
+}
+
+//--------------------------------------------------
+// Passes a behavior recall on to the workers, which fly the platforms
+void coordHandleRecall(int sig) {
+	int i;
+	for (i = 0; i < coordWorkers; ++i) kill(coordShared->stats[i].pid, SIGUSR1);
+}
+
+//--------------------------------------------------
+// Worker process: sends to its range of streams until killed
+void coordWorkerRun(int index) {
+	struct coordWorkerStats *stats = &coordShared->stats[index];
+	struct sockaddr_in *dests;
+	struct ratePacer pacer;
+	uint64_t times[PACKET_BATCH_MAX];
+	int streams[PACKET_BATCH_MAX];
+	uint64_t start, now, packets = 0, errors = 0, late = 0;
+	int i, n, first;
+
+	if (udpInit() == -1 || exprInitStreams(stats->firstStream, stats->streamCount) == -1 ||
+			behaviorInit(stats->firstStream, stats->streamCount) == -1) exit(-1);
+	dests = malloc(sizeof(*dests) * stats->streamCount);
+	if (dests == NULL) {
+		printf("ERROR: Unable to allocate worker destinations\n");
+		exit(-1);
+	}
+	for (i = 0; i < stats->streamCount; ++i) {
+		dests[i] = servaddr;
+		dests[i].sin_port = htons(servPort + stats->firstStream + i);
+	}
+
+	__atomic_add_fetch(&coordShared->ready, 1, __ATOMIC_RELEASE);
+	while ((start = __atomic_load_n(&coordShared->startTime, __ATOMIC_ACQUIRE)) == 0) usleep(1000);
+	sleepUntil(start);
+	if (sendRate > 0) {
+		ratePacerInit(&pacer);
+		pacer.deadline = start;
+	}
+
+	for (first = 0; ; first = (first + n) % stats->streamCount) {
+		if (sendRate > 0 && first == 0) {
+			// One packet per stream per tick
+			sleepUntil(pacer.deadline);
+			if (monotonicNanoseconds() > pacer.deadline + pacer.period / 2) late++;
+			ratePacerNext(&pacer);
+		}
+		n = stats->streamCount - first < sendBatch ? stats->streamCount - first : sendBatch;
+		now = updateTimestamp();
+		for (i = 0; i < n; ++i) {
+			streams[i] = stats->firstStream + first + i;
+			times[i] = clockModelTime(streams[i], now);
+		}
+		makePacketBatch(packetPoolSlots, times, streams, n);
+		if (udpSendBatchTo(packetPoolSlots, NULL, &dests[first], n) == -1) errors++;
+		else packets += n;
+
+		// Only this worker writes its counters
+		__atomic_store_n(&stats->packets, packets, __ATOMIC_RELAXED);
+		__atomic_store_n(&stats->errors, errors, __ATOMIC_RELAXED);
+		__atomic_store_n(&stats->lateTicks, late, __ATOMIC_RELAXED);
+	}
+}
+
+//--------------------------------------------------
+// Prints the totals over all workers, with each worker's share if detailed
+void coordReport(uint64_t *lastPackets, uint64_t elapsed, int detailed) {
+	uint64_t packets = 0, errors = 0, late = 0;
+	int i;
+	for (i = 0; i < coordWorkers; ++i) {
+		struct coordWorkerStats *stats = &coordShared->stats[i];
+		packets += __atomic_load_n(&stats->packets, __ATOMIC_RELAXED);
+		errors += __atomic_load_n(&stats->errors, __ATOMIC_RELAXED);
+		late += __atomic_load_n(&stats->lateTicks, __ATOMIC_RELAXED);
+		if (detailed) {
+			printf("  Worker %d (pid %d, streams %d-%d): %llu packets, %llu errors, %llu late ticks\n", i,
+					stats->pid, stats->firstStream, stats->firstStream + stats->streamCount - 1,
+					(unsigned long long)stats->packets, (unsigned long long)stats->errors,
+					(unsigned long long)stats->lateTicks);
+		}
+	}
+	printf("Packets: %llu (%.0f/s), %.1f MB/s, errors: %llu, late ticks: %llu\n", (unsigned long long)packets,
+			elapsed ? (packets - *lastPackets) * 1e9 / elapsed : 0.0,
+			elapsed ? (packets - *lastPackets) * (double)packetLength * 1e3 / elapsed : 0.0,
+			(unsigned long long)errors, (unsigned long long)late);
+	fflush(stdout);
+	*lastPackets = packets;
+}
+
+//--------------------------------------------------
+// Forks the workers, starts them together and reports until they exit or
+// the coordinator is interrupted. Returns -1 if the workers can't be started.
+int coordRun(void) {
+	uint64_t period = 0, next, last, lastPackets = 0, begin;
+	int i, alive, waited;
+	pid_t pid;
+
+	if (coordStreams == 0) coordStreams = coordWorkers;
+	if (coordWorkers > coordStreams) coordWorkers = coordStreams;
+	coordShared = mmap(NULL, sizeof(struct coordSegment), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (coordShared == MAP_FAILED) {
+		perror("Unable to map coordinator segment");
+		return -1;
+	}
+	memset(coordShared, 0, sizeof(struct coordSegment));
+	coordShared->workers = coordWorkers;
+	coordShared->streams = coordStreams;
+	for (i = 0; i < coordWorkers; ++i) {
+		coordShared->stats[i].streamCount = coordStreams / coordWorkers + (i < coordStreams % coordWorkers);
+		coordShared->stats[i].firstStream = i == 0 ? 0 :
+				coordShared->stats[i - 1].firstStream + coordShared->stats[i - 1].streamCount;
+	}
+
+	printf("Starting %d workers for %d streams on ports %d-%d\n", coordWorkers, coordStreams, servPort,
+			servPort + coordStreams - 1);
+	fflush(stdout); // Buffered output would be printed again by every worker
+	for (i = 0; i < coordWorkers; ++i) {
+		pid = fork();
+		if (pid == 0) {
+			coordWorkerRun(i);
+			exit(0);
+		}
+		if (pid < 0) {
+			perror("Unable to start worker");
+			while (--i >= 0) kill(coordShared->stats[i].pid, SIGTERM);
+			return -1;
+		}
+		coordShared->stats[i].pid = pid;
+	}
+	signal(SIGINT, coordHandleSignal);
+	signal(SIGTERM, coordHandleSignal);
+	signal(SIGHUP, coordHandleSignal);
+	if (behaviorEnabled) signal(SIGUSR1, coordHandleRecall);
+
+	for (waited = 0; __atomic_load_n(&coordShared->ready, __ATOMIC_ACQUIRE) < coordWorkers; ++waited) {
+		if (waited == COORD_READY_TIMEOUT || coordStop || waitpid(-1, NULL, WNOHANG) > 0) {
+			printf("ERROR: Workers did not start\n");
+			for (i = 0; i < coordWorkers; ++i) kill(coordShared->stats[i].pid, SIGTERM);
+			while (wait(NULL) > 0);
+			return -1;
+		}
+		usleep(1000);
+	}
+	if (sendRate > 0) period = rateDenominator * 1000000000 / rateNumerator;
+	begin = streamStartTime(period);
+	if (startBoundary == 0) begin += COORD_START_LEAD;
+	__atomic_store_n(&coordShared->startTime, begin, __ATOMIC_RELEASE);
+
+	sleepUntil(begin);
+	last = begin;
+	for (alive = coordWorkers; alive > 0 && !coordStop; ) {
+		next = last + COORD_REPORT_INTERVAL;
+		while (!coordStop && monotonicNanoseconds() < next) usleep(10000);
+		while (waitpid(-1, NULL, WNOHANG) > 0) alive--;
+		if (coordStop) break;
+		coordReport(&lastPackets, next - last, 0);
+		last = next;
+	}
+	for (i = 0; i < coordWorkers; ++i) kill(coordShared->stats[i].pid, SIGTERM);
+	while (wait(NULL) > 0);
+
+	printf("Final report after %.1f seconds:\n", (monotonicNanoseconds() - begin) / 1e9);
+	lastPackets = 0;
+	coordReport(&lastPackets, monotonicNanoseconds() - begin, 1);
+	munmap(coordShared, sizeof(struct coordSegment));
+	return 0;
+}
+#endif
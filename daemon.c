@@ -0,0 +1,447 @@
+//============================================================================
+//		Generator daemon
+// Runs jobs on request instead of one stream per process launch. A job is a
+// set of streams with its own rate, sink and trajectory, managed over a Unix
+// stream socket with one command per line:
+// create [key=value ...]: start a job, replies "OK <id>"
+// update <id> key=value ...: change a running job
+// pause <id>, resume <id>, destroy <id>
+// list: one line per job with its packet and failed send counts, then "OK"
+// Keys: rate (packets per second, 30000/1001 form allowed), address, port,
+// streams (sent to port .. port + streams - 1), mission, platform, lat, lon,
+// alt, heading (degrees), speed (meters per second). Unset keys take the
+// command line values. The trajectory is a straight track from lat/lon at
+// heading and speed, an update starts it again from there.
+// Errors are replied as "ERROR <reason>".
+//
+// Every job is driven by one loop on one socket: it polls the control
+// socket until the earliest job deadline, then sends each due job's packet
+// to all its streams in sendmmsg batches. Creating a job costs a template
+// build, its first packet goes out on the next pass of the loop. A send
+// that fails (unreachable sink, full buffers) is logged and counted on its
+// job, which keeps running like the others.
+// Jobs share the packet layout from the command line, so the orbit, VMTI and
+// footprint options aren't available to them.
+//
+// Example usage: ./klvgen -d /tmp/klvgen.sock
+//   echo "create rate=30000/1001 port=9300 streams=4 speed=50" | socat - UNIX:/tmp/klvgen.sock
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifndef WIN32
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#	define MSG_NOSIGNAL 0
+#endif
+
+#define DAEMON_JOB_MAX 256
+#define DAEMON_CLIENT_MAX 16
+#define DAEMON_STREAM_MAX 1024
+#define DAEMON_LINE_MAX 512
+#define DAEMON_BACKLOG_MAX 16 // Periods a job may fall behind before its deadlines are reset
+
+//============================================================================
+
+struct daemonJob {
+	int id; // 0 = free slot
+	int paused;
+	char address[16];
+	int port;
+	int streams;
+	struct sockaddr_in *dests;
+	struct ratePacer pacer;
+	char missionId[13];
+	char platform[13];
+	double latitude; // Start of the track, degrees
+	double longitude;
+	double altitude; // Meters
+	double heading; // Degrees
+	double speed; // Meters per second
+	uint64_t trackStart; // UNIX microseconds the track starts from
+	unsigned char *template; // Packet with a zero timestamp
+	uint64_t packets;
+	uint64_t errors; // Failed sends
+	int lastError; // errno of the last one
+};
+
+// A control connection and its partial command line
+struct daemonClient {
+	int fd; // -1 = free slot
+	size_t length;
+	char line[DAEMON_LINE_MAX];
+};
+
+char daemonSocket[108];
+int daemonFd = -1;
+int daemonNextId = 1;
+struct daemonJob daemonJobs[DAEMON_JOB_MAX];
+struct daemonClient daemonClients[DAEMON_CLIENT_MAX];
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Sends a formatted reply line to a control connection
+void daemonReply(int fd, const char *format, ...) {
+	char reply[DAEMON_LINE_MAX];
+	va_list args;
+	int len;
+	va_start(args, format);
+	len = vsnprintf(reply, sizeof(reply), format, args);
+	va_end(args);
+	if (len >= (int)sizeof(reply)) len = sizeof(reply) - 1;
+	send(fd, reply, len, MSG_NOSIGNAL);
+}
+
+//--------------------------------------------------
+// Returns the job with the given id as text, or NULL
+struct daemonJob *daemonFindJob(const char *id) {
+	int value = id != NULL ? atoi(id) : 0, i;
+	for (i = 0; i < DAEMON_JOB_MAX; ++i) {
+		if (value > 0 && daemonJobs[i].id == value) return &daemonJobs[i];
+	}
+	return NULL;
+}
+
+//--------------------------------------------------
+// Applies one key=value to a job, returns an error message or NULL
+const char *daemonSetOption(struct daemonJob *job, char *option) {
+	char *value = strchr(option, '=');
+	struct in_addr addr;
+	uint64_t num, den;
+
+	if (value == NULL) return "options must be key=value";
+	*value++ = '\0';
+	if (strcmp(option, "rate") == 0) {
+		if (parseRateValue(value, &num, &den) == -1 || num == 0 || (double)num / den > 1000000)
+			return "rate must be above 0 and at most 1000000";
+		ratePacerStart(&job->pacer, num, den, job->pacer.deadline);
+	}
+	else if (strcmp(option, "address") == 0) {
+		if (strlen(value) > 15 || inet_aton(value, &addr) == 0) return "address must be a dotted quad";
+		strcpy(job->address, value);
+	}
+	else if (strcmp(option, "port") == 0) {
+		job->port = atoi(value);
+		if (job->port < 1 || job->port > 65535) return "port out of range";
+	}
+	else if (strcmp(option, "streams") == 0) {
+		job->streams = atoi(value);
+		if (job->streams < 1 || job->streams > DAEMON_STREAM_MAX) return "streams out of range";
+	}
+	else if (strcmp(option, "mission") == 0) {
+		memset(job->missionId, 0, sizeof(job->missionId));
+		strncpy(job->missionId, value, 12);
+	}
+	else if (strcmp(option, "platform") == 0) {
+		memset(job->platform, 0, sizeof(job->platform));
+		strncpy(job->platform, value, 12);
+	}
+	else if (strcmp(option, "lat") == 0) {
+		job->latitude = atof(value);
+		if (job->latitude < -90 || job->latitude > 90) return "lat out of range";
+	}
+	else if (strcmp(option, "lon") == 0) {
+		job->longitude = atof(value);
+		if (job->longitude < -180 || job->longitude > 180) return "lon out of range";
+	}
+	else if (strcmp(option, "alt") == 0) {
+		job->altitude = atof(value);
+		if (job->altitude < -900 || job->altitude > 19000) return "alt out of range";
+	}
+	else if (strcmp(option, "heading") == 0) job->heading = atof(value);
+	else if (strcmp(option, "speed") == 0) {
+		job->speed = atof(value);
+		if (job->speed < 0) return "speed must be 0 or greater";
+	}
+	else return "unknown option";
+	if (job->port + job->streams > 65536) return "streams must fit above the port";
+	return NULL;
+}
+
+//--------------------------------------------------
+// Builds a job's destinations and packet template from its settings, the
+// command line fields are swapped out while its template is written. The
+// position is written per packet by daemonSendJob().
+int daemonBuildJob(struct daemonJob *job) {
+	char savedMission[13], savedPlatform[13];
+	uint16_t savedAltitude = altitude;
+	uint64_t savedTimestamp = timestamp;
+	struct sockaddr_in *dests;
+	int i;
+
+	dests = realloc(job->dests, sizeof(*dests) * job->streams);
+	if (dests == NULL) return -1;
+	job->dests = dests;
+	for (i = 0; i < job->streams; ++i) {
+		memset(&dests[i], 0, sizeof(dests[i]));
+		dests[i].sin_family = AF_INET;
+		dests[i].sin_addr.s_addr = inet_addr(job->address);
+		dests[i].sin_port = htons(job->port + i);
+	}
+	if (job->template == NULL) job->template = malloc(packetLength);
+	if (job->template == NULL) return -1;
+
+	memcpy(savedMission, missionId, sizeof(savedMission));
+	memcpy(savedPlatform, platform, sizeof(savedPlatform));
+	memcpy(missionId, job->missionId, sizeof(savedMission));
+	memcpy(platform, job->platform, sizeof(savedPlatform));
+	altitude = htons((uint16_t)floor((job->altitude + 900) / 19900 * 65535 + 0.5));
+	timestamp = 0;
+	writePacketFields(job->template);
+	memcpy(missionId, savedMission, sizeof(savedMission));
+	memcpy(platform, savedPlatform, sizeof(savedPlatform));
+	altitude = savedAltitude;
+	timestamp = savedTimestamp;
+	job->trackStart = updateTimestamp();
+	return 0;
+}
+
+//--------------------------------------------------
+// Releases a job's slot
+void daemonFreeJob(struct daemonJob *job) {
+	free(job->dests);
+	free(job->template);
+	memset(job, 0, sizeof(*job));
+}
+
+//--------------------------------------------------
+// Applies the options after the command word, replying on failure. Returns
+// -1 without changing the job if any is invalid.
+int daemonApplyOptions(int fd, struct daemonJob *job, char *options) {
+	struct daemonJob next = *job;
+	const char *error;
+	char *option, *save = NULL;
+
+	for (option = strtok_r(options, " \t", &save); option != NULL; option = strtok_r(NULL, " \t", &save)) {
+		error = daemonSetOption(&next, option);
+		if (error != NULL) {
+			daemonReply(fd, "ERROR %s: %s\n", option, error);
+			return -1;
+		}
+	}
+	if (next.pacer.numerator != job->pacer.numerator || next.pacer.denominator != job->pacer.denominator)
+		next.pacer.deadline = monotonicNanoseconds();
+	*job = next;
+	if (daemonBuildJob(job) == -1) {
+		daemonReply(fd, "ERROR unable to allocate job\n");
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Runs one control command
+void daemonCommand(int fd, char *line) {
+	char *command, *id, *options, *save = NULL;
+	struct daemonJob *job;
+	int i;
+
+	command = strtok_r(line, " \t\r", &save);
+	if (command == NULL) return;
+	options = save;
+	if (strcmp(command, "create") == 0) {
+		for (job = NULL, i = 0; i < DAEMON_JOB_MAX && job == NULL; ++i) {
+			if (daemonJobs[i].id == 0) job = &daemonJobs[i];
+		}
+		if (job == NULL) {
+			daemonReply(fd, "ERROR too many jobs\n");
+			return;
+		}
+		strcpy(job->address, address);
+		job->port = servPort;
+		job->streams = 1;
+		memcpy(job->missionId, missionId, sizeof(job->missionId));
+		memcpy(job->platform, platform, sizeof(job->platform));
+		job->latitude = latitudeDegrees;
+		job->longitude = longitudeDegrees;
+		job->altitude = altitudeMeters;
+		ratePacerStart(&job->pacer, rateNumerator, rateDenominator, monotonicNanoseconds());
+		if (daemonApplyOptions(fd, job, options) == -1) {
+			daemonFreeJob(job);
+			return;
+		}
+		job->id = daemonNextId++;
+		daemonReply(fd, "OK %d\n", job->id);
+		return;
+	}
+	if (strcmp(command, "list") == 0) {
+		for (i = 0; i < DAEMON_JOB_MAX; ++i) {
+			job = &daemonJobs[i];
+			if (job->id == 0) continue;
+			daemonReply(fd, "JOB %d %s rate %llu/%llu sink %s:%d-%d packets %llu errors %llu%s%s%s\n", job->id,
+					job->paused ? "paused" : "running", (unsigned long long)job->pacer.numerator,
+					(unsigned long long)job->pacer.denominator, job->address, job->port,
+					job->port + job->streams - 1, (unsigned long long)job->packets,
+					(unsigned long long)job->errors, job->errors > 0 ? " (" : "",
+					job->errors > 0 ? strerror(job->lastError) : "", job->errors > 0 ? ")" : "");
+		}
+		daemonReply(fd, "OK\n");
+		return;
+	}
+
+	id = strtok_r(NULL, " \t\r", &save);
+	options = save;
+	job = daemonFindJob(id);
+	if (strcmp(command, "update") != 0 && strcmp(command, "pause") != 0 &&
+			strcmp(command, "resume") != 0 && strcmp(command, "destroy") != 0) {
+		daemonReply(fd, "ERROR unknown command %s\n", command);
+		return;
+	}
+	if (job == NULL) {
+		daemonReply(fd, "ERROR no job %s\n", id != NULL ? id : "given");
+		return;
+	}
+	if (strcmp(command, "update") == 0) {
+		if (daemonApplyOptions(fd, job, options) == -1) return;
+	}
+	else if (strcmp(command, "pause") == 0) job->paused = 1;
+	else if (strcmp(command, "resume") == 0) {
+		if (job->paused) job->pacer.deadline = monotonicNanoseconds();
+		job->paused = 0;
+	}
+	else daemonFreeJob(job);
+	daemonReply(fd, "OK\n");
+}
+
+//--------------------------------------------------
+// Reads from a control connection and runs its complete lines, returns -1
+// when it has closed
+int daemonReadClient(struct daemonClient *client) {
+	ssize_t len = recv(client->fd, &client->line[client->length], DAEMON_LINE_MAX - 1 - client->length, 0);
+	char *start, *end;
+
+	if (len <= 0) return -1;
+	client->length += len;
+	client->line[client->length] = '\0';
+	for (start = client->line; (end = strchr(start, '\n')) != NULL; start = end + 1) {
+		*end = '\0';
+		daemonCommand(client->fd, start);
+	}
+	client->length -= start - client->line;
+	memmove(client->line, start, client->length);
+	if (client->length == DAEMON_LINE_MAX - 1) {
+		daemonReply(client->fd, "ERROR command too long\n");
+		client->length = 0;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Sends a job's packet for the given time to all its streams, a failed
+// batch is counted on the job and the rest are still sent
+void daemonSendJob(struct daemonJob *job, uint64_t now) {
+	unsigned char *slots[PACKET_BATCH_MAX];
+	double elapsed = (now - job->trackStart) / 1e6, lat, lon;
+	uint64_t netTime = htonll(now);
+	uint32_t netLat, netLon;
+	uint16_t netChecksum;
+	int i, n, first, sent;
+
+	lat = job->latitude + job->speed * elapsed * cos(job->heading * MOTION_RADIANS) / (MOTION_EARTH_RADIUS * MOTION_RADIANS);
+	lon = job->longitude + job->speed * elapsed * sin(job->heading * MOTION_RADIANS) /
+			(MOTION_EARTH_RADIUS * cos(job->latitude * MOTION_RADIANS) * MOTION_RADIANS);
+	lon = fmod(lon + 540, 360) - 180;
+	netLat = htonl((uint32_t)mapSigned(lat, 90, 2147483647));
+	netLon = htonl((uint32_t)mapSigned(lon, 180, 2147483647));
+
+	memcpy(packetBuffer, job->template, packetLength);
+	memcpy(&packetBuffer[timestampOffset], &netTime, 8);
+	memcpy(&packetBuffer[motionOffset + 2], &netLat, 4);
+	memcpy(&packetBuffer[motionOffset + 8], &netLon, 4);
+	netChecksum = htons(packetChecksum(packetBuffer, packetLength - 2));
+	memcpy(&packetBuffer[packetLength - 2], &netChecksum, 2);
+
+	// Every stream gets the same packet
+	for (i = 0; i < PACKET_BATCH_MAX; ++i) slots[i] = packetBuffer;
+	for (first = 0; first < job->streams; first += n) {
+		n = job->streams - first < sendBatch ? job->streams - first : sendBatch;
+		sent = udpSendBatchTo(slots, NULL, &job->dests[first], n);
+		if (sent == -1) {
+			job->errors++;
+			job->lastError = errno;
+		}
+		else job->packets += sent;
+	}
+}
+
+//--------------------------------------------------
+// Serves the control socket and runs the jobs, returns -1 on failure
+int daemonRun(void) {
+	struct pollfd fds[1 + DAEMON_CLIENT_MAX];
+	struct sockaddr_un sun;
+	uint64_t now, next;
+	int i, n, ready, timeout;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, daemonSocket);
+	unlink(daemonSocket);
+	daemonFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (daemonFd < 0 || bind(daemonFd, (struct sockaddr *)&sun, sizeof(sun)) != 0 || listen(daemonFd, 8) != 0) {
+		perror("Unable to open control socket");
+		return -1;
+	}
+	for (i = 0; i < DAEMON_CLIENT_MAX; ++i) daemonClients[i].fd = -1;
+	printf("Daemon listening on %s\n", daemonSocket);
+	fflush(stdout);
+
+	while (1) {
+		next = UINT64_MAX;
+		for (i = 0; i < DAEMON_JOB_MAX; ++i) {
+			if (daemonJobs[i].id != 0 && !daemonJobs[i].paused && daemonJobs[i].pacer.deadline < next)
+				next = daemonJobs[i].pacer.deadline;
+		}
+		now = monotonicNanoseconds();
+		timeout = next == UINT64_MAX ? -1 : next <= now ? 0 : (int)((next - now) / 1000000);
+
+		fds[0].fd = daemonFd;
+		fds[0].events = POLLIN;
+		for (n = 1, i = 0; i < DAEMON_CLIENT_MAX; ++i) {
+			if (daemonClients[i].fd < 0) continue;
+			fds[n].fd = daemonClients[i].fd;
+			fds[n++].events = POLLIN;
+		}
+		ready = poll(fds, n, timeout);
+		if (ready > 0) {
+			for (i = 1; i < n; ++i) {
+				struct daemonClient *client;
+				if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+				for (client = daemonClients; client->fd != fds[i].fd; ++client);
+				if (daemonReadClient(client) == -1) {
+					close(client->fd);
+					client->fd = -1;
+					client->length = 0;
+				}
+			}
+			if (fds[0].revents & POLLIN) {
+				int fd = accept(daemonFd, NULL, NULL);
+				for (i = 0; fd >= 0 && i < DAEMON_CLIENT_MAX && daemonClients[i].fd >= 0; ++i);
+				if (fd >= 0 && i == DAEMON_CLIENT_MAX) {
+					daemonReply(fd, "ERROR too many connections\n");
+					close(fd);
+				}
+				else if (fd >= 0) daemonClients[i].fd = fd;
+			}
+		}
+		// poll() only waits whole milliseconds
+		else if (ready == 0 && next != UINT64_MAX) sleepUntil(next);
+
+		now = monotonicNanoseconds();
+		for (i = 0; i < DAEMON_JOB_MAX; ++i) {
+			struct daemonJob *job = &daemonJobs[i];
+			if (job->id == 0 || job->paused || job->pacer.deadline > now) continue;
+#ifdef __gnu_linux__
+			txstampScheduled = job->pacer.deadline;
+#endif
+			daemonSendJob(job, updateTimestamp());
+			ratePacerNext(&job->pacer);
+			if (job->pacer.deadline + DAEMON_BACKLOG_MAX * job->pacer.period < now) job->pacer.deadline = now;
+		}
+	}
+}
+#endif
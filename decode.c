@@ -0,0 +1,193 @@
+//============================================================================
+//		KLV packet decoder
+// Walks a UAS Datalink Local Set packet once and indexes its items as
+// (tag, offset, length) views into the caller's buffer, nothing is copied.
+// Checks made on every packet:
+// Key: must match uasLdsKey
+// Lengths: outer and item BER lengths must fit in the buffer exactly, and
+//   the packet in one UDP datagram
+// Checksum: last item must be tag 1, matching the MISB 601.2 checksum
+//
+// Typed accessors read the timestamp, latitude, longitude and altitude
+// straight from the views, undoing the mappings in klvgen.c.
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#define KLV_VIEW_MAX 96 // Items indexed per packet, more is treated as malformed
+
+// Decoder results, a decoded packet returns its length instead
+#define KLV_DECODE_SHORT -1 // Buffer ends before the packet does
+#define KLV_DECODE_BAD_KEY -2
+#define KLV_DECODE_BAD_LENGTH -3 // A BER length is malformed or items overrun the packet
+#define KLV_DECODE_BAD_CHECKSUM -4
+
+//============================================================================
+
+// One item of a decoded packet, offset is from the start of the packet
+struct klvView {
+	uint32_t tag;
+	uint32_t offset;
+	uint32_t length;
+};
+
+// Index of a decoded packet, views point into buff
+struct klvPacket {
+	const unsigned char *buff;
+	uint32_t length; // Whole packet, key to checksum
+	int count;
+	int timestampView; // Index into views for the typed accessors, -1 if absent
+	int latitudeView;
+	int longitudeView;
+	int altitudeView;
+	struct klvView views[KLV_VIEW_MAX];
+};
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Reads a BER length at buff[*pos], advancing pos. Returns -1 if it is
+// malformed or runs past end.
+int64_t berDecodeLength(const unsigned char *buff, uint32_t *pos, uint32_t end) {
+	uint64_t len;
+	int bytes, i;
+	if (*pos >= end) return -1;
+	len = buff[(*pos)++];
+	if (len < 128) return len;
+	bytes = len & 0x7F;
+	if (bytes == 0 || bytes > 4 || *pos + bytes > end) return -1;
+	for (len = 0, i = 0; i < bytes; ++i) len = (len << 8) | buff[(*pos)++];
+	return len;
+}
+
+//--------------------------------------------------
+// Reads a BER-OID tag at buff[*pos], advancing pos. Returns -1 if it runs
+// past end or is longer than 4 bytes.
+int64_t berDecodeOid(const unsigned char *buff, uint32_t *pos, uint32_t end) {
+	uint32_t value = 0;
+	int i;
+	for (i = 0; i < 4 && *pos < end; ++i) {
+		unsigned char b = buff[(*pos)++];
+		value = (value << 7) | (b & 0x7F);
+		if ((b & 0x80) == 0) return value;
+	}
+	return -1;
+}
+
+//--------------------------------------------------
+// Decodes the packet at the start of buff into pkt. Returns the packet
+// length, or one of the KLV_DECODE_ codes.
+int klvDecode(const unsigned char *buff, size_t available, struct klvPacket *pkt) {
+	uint32_t pos = 16, end, valueStart;
+	int64_t len, tag;
+	uint16_t stored;
+
+	if (available < 18) return KLV_DECODE_SHORT;
+	if (memcmp(buff, uasLdsKey, 16) != 0) return KLV_DECODE_BAD_KEY;
+	if ((buff[16] & 0x80) && available < 17 + (size_t)(buff[16] & 0x7F)) return KLV_DECODE_SHORT;
+	len = berDecodeLength(buff, &pos, available);
+	if (len < 0 || pos + len > PACKET_MAX) return KLV_DECODE_BAD_LENGTH;
+	if (pos + len > available) return KLV_DECODE_SHORT;
+	end = pos + (uint32_t)len;
+
+	pkt->buff = buff;
+	pkt->length = end;
+	pkt->count = 0;
+	pkt->timestampView = pkt->latitudeView = pkt->longitudeView = pkt->altitudeView = -1;
+	while (pos < end) {
+		if (pkt->count == KLV_VIEW_MAX) return KLV_DECODE_BAD_LENGTH;
+		// Single byte tags and short form lengths are the common case
+		if (pos + 1 < end && buff[pos] < 0x80 && buff[pos + 1] < 0x80) {
+			tag = buff[pos];
+			len = buff[pos + 1];
+			pos += 2;
+		}
+		else {
+			tag = berDecodeOid(buff, &pos, end);
+			if (tag < 0) return KLV_DECODE_BAD_LENGTH;
+			len = berDecodeLength(buff, &pos, end);
+			if (len < 0) return KLV_DECODE_BAD_LENGTH;
+		}
+		if (pos + len > end) return KLV_DECODE_BAD_LENGTH;
+		valueStart = pos;
+		pos += (uint32_t)len;
+		switch (tag) {
+			case 0x02: if (len == 8) pkt->timestampView = pkt->count; break;
+			case 0x0D: if (len == 4) pkt->latitudeView = pkt->count; break;
+			case 0x0E: if (len == 4) pkt->longitudeView = pkt->count; break;
+			case 0x0F: if (len == 2) pkt->altitudeView = pkt->count; break;
+		}
+		pkt->views[pkt->count].tag = (uint32_t)tag;
+		pkt->views[pkt->count].offset = valueStart;
+		pkt->views[pkt->count].length = (uint32_t)len;
+		pkt->count++;
+	}
+
+	// The checksum is the last item and covers everything before its value
+	if (pkt->count == 0 || pkt->views[pkt->count - 1].tag != 0x01 || pkt->views[pkt->count - 1].length != 2)
+		return KLV_DECODE_BAD_CHECKSUM;
+	memcpy(&stored, &buff[end - 2], 2);
+	if (ntohs(stored) != makeChecksum((unsigned char *)buff, end - 2)) return KLV_DECODE_BAD_CHECKSUM;
+	return end;
+}
+
+//--------------------------------------------------
+// Returns the view for a tag, or NULL if the packet doesn't carry it
+const struct klvView *klvFind(const struct klvPacket *pkt, uint32_t tag) {
+	int i;
+	for (i = 0; i < pkt->count; ++i) {
+		if (pkt->views[i].tag == tag) return &pkt->views[i];
+	}
+	return NULL;
+}
+
+//--------------------------------------------------
+// Reads a big-endian unsigned value from a view of up to 8 bytes
+uint64_t klvViewUint(const struct klvPacket *pkt, const struct klvView *view) {
+	const unsigned char *value = &pkt->buff[view->offset];
+	uint64_t result = 0;
+	uint32_t i;
+	for (i = 0; i < view->length && i < 8; ++i) result = (result << 8) | value[i];
+	return result;
+}
+
+//--------------------------------------------------
+// UNIX timestamp in microseconds, 0 if absent
+uint64_t klvTimestamp(const struct klvPacket *pkt) {
+	uint64_t value;
+	if (pkt->timestampView < 0) return 0;
+	memcpy(&value, &pkt->buff[pkt->views[pkt->timestampView].offset], 8);
+	return htonll(value);
+}
+
+//--------------------------------------------------
+// Sensor latitude in degrees, NaN if absent or the error indicator
+double klvLatitude(const struct klvPacket *pkt) {
+	uint32_t value;
+	if (pkt->latitudeView < 0) return NAN;
+	memcpy(&value, &pkt->buff[pkt->views[pkt->latitudeView].offset], 4);
+	value = ntohl(value);
+	if (value == 0x80000000) return NAN;
+	return (int32_t)value * (90.0 / 2147483647.0);
+}
+
+//--------------------------------------------------
+// Sensor longitude in degrees, NaN if absent or the error indicator
+double klvLongitude(const struct klvPacket *pkt) {
+	uint32_t value;
+	if (pkt->longitudeView < 0) return NAN;
+	memcpy(&value, &pkt->buff[pkt->views[pkt->longitudeView].offset], 4);
+	value = ntohl(value);
+	if (value == 0x80000000) return NAN;
+	return (int32_t)value * (180.0 / 2147483647.0);
+}
+
+//--------------------------------------------------
+// Sensor true altitude in meters, NaN if absent
+double klvAltitude(const struct klvPacket *pkt) {
+	uint16_t value;
+	if (pkt->altitudeView < 0) return NAN;
+	memcpy(&value, &pkt->buff[pkt->views[pkt->altitudeView].offset], 2);
+	return ntohs(value) * (19900.0 / 65535.0) - 900.0;
+}
@@ -0,0 +1,146 @@
+//============================================================================
+//		Terrain elevation from SRTM tiles
+// Looks up terrain height from SRTM .hgt tiles in a local directory, one
+// tile per 1x1 degree cell named by its southwest corner (N44W094.hgt).
+// Tiles are square grids of big-endian signed 16-bit meters, rows north to
+// south, 1201 samples (3 arc-second) or 3601 samples (1 arc-second) across.
+//
+// Tiles are mmap'd on first use and kept in a small LRU cache, so lookups
+// along a line of sight touch only the pages they need. Heights are
+// bilinearly interpolated between samples. Missing tiles and voids read as
+// sea level.
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define DEM_CACHE_TILES 16
+#define DEM_VOID -32768
+
+//============================================================================
+
+// A mapped tile, samples is NULL for cells without a tile file
+struct demTile {
+	int lat; // Southwest corner, degrees
+	int lon;
+	const unsigned char *samples;
+	size_t mapLength;
+	int size; // Samples per row and column
+	uint64_t lastUse;
+};
+
+char demDirectory[256]; // Empty = flat terrain at sea level
+struct demTile demCache[DEM_CACHE_TILES];
+int demCacheCount;
+uint64_t demClock;
+struct demTile *demLastTile;
+uint64_t demTileLoads;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Maps the tile file for a cell into an entry, samples stay NULL if there is none
+void demLoadTile(struct demTile *tile, int lat, int lon) {
+#ifndef WIN32
+	char path[300];
+	struct stat st;
+	int fd, size;
+#endif
+	tile->lat = lat;
+	tile->lon = lon;
+	tile->samples = NULL;
+	tile->mapLength = 0;
+	tile->size = 0;
+	demTileLoads++;
+#ifndef WIN32
+	snprintf(path, sizeof(path), "%s/%c%02d%c%03d.hgt", demDirectory, lat < 0 ? 'S' : 'N', abs(lat),
+			lon < 0 ? 'W' : 'E', abs(lon));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return;
+	if (fstat(fd, &st) == 0) {
+		size = (int)floor(sqrt(st.st_size / 2.0) + 0.5);
+		if (size >= 2 && (off_t)size * size * 2 == st.st_size) {
+			tile->samples = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (tile->samples == MAP_FAILED) tile->samples = NULL;
+			else {
+				tile->mapLength = st.st_size;
+				tile->size = size;
+			}
+		}
+		else printf("WARNING: %s is not a square SRTM tile\n", path);
+	}
+	close(fd);
+#endif
+}
+
+//--------------------------------------------------
+// Returns the cached tile for a cell, loading it over the least recently used one
+struct demTile *demFindTile(int lat, int lon) {
+	struct demTile *tile = NULL;
+	int i;
+
+	if (demLastTile != NULL && demLastTile->lat == lat && demLastTile->lon == lon) {
+		demLastTile->lastUse = ++demClock;
+		return demLastTile;
+	}
+	for (i = 0; i < demCacheCount; ++i) {
+		if (demCache[i].lat == lat && demCache[i].lon == lon) {
+			tile = &demCache[i];
+			break;
+		}
+	}
+	if (tile == NULL) {
+		if (demCacheCount < DEM_CACHE_TILES) tile = &demCache[demCacheCount++];
+		else {
+			tile = &demCache[0];
+			for (i = 1; i < DEM_CACHE_TILES; ++i) {
+				if (demCache[i].lastUse < tile->lastUse) tile = &demCache[i];
+			}
+#ifndef WIN32
+			if (tile->samples != NULL) munmap((void *)tile->samples, tile->mapLength);
+#endif
+		}
+		demLoadTile(tile, lat, lon);
+	}
+	tile->lastUse = ++demClock;
+	demLastTile = tile;
+	return tile;
+}
+
+//--------------------------------------------------
+// Height of one sample in meters, voids read as 0
+double demSample(const struct demTile *tile, int row, int col) {
+	const unsigned char *sample = &tile->samples[((size_t)row * tile->size + col) * 2];
+	int16_t height = (int16_t)((sample[0] << 8) | sample[1]);
+	return height == DEM_VOID ? 0.0 : height;
+}
+
+//--------------------------------------------------
+// Terrain height in meters at a position, bilinear between the nearest samples
+double demElevation(double lat, double lon) {
+	struct demTile *tile;
+	double row, col, fr, fc;
+	int r, c, last;
+
+	if (demDirectory[0] == '\0') return 0.0;
+	tile = demFindTile((int)floor(lat), (int)floor(lon));
+	if (tile->samples == NULL) return 0.0;
+
+	last = tile->size - 1;
+	row = (tile->lat + 1 - lat) * last;
+	col = (lon - tile->lon) * last;
+	r = (int)row;
+	c = (int)col;
+	if (r >= last) r = last - 1;
+	if (c >= last) c = last - 1;
+	fr = row - r;
+	fc = col - c;
+	return (demSample(tile, r, c) * (1 - fc) + demSample(tile, r, c + 1) * fc) * (1 - fr) +
+			(demSample(tile, r + 1, c) * (1 - fc) + demSample(tile, r + 1, c + 1) * fc) * fr;
+}
@@ -0,0 +1,503 @@
+//============================================================================
+//		Field expressions
+// Drives packet fields from formulas given on the command line, e.g.
+//   -E "alt=1500 + 200 * sin(t / 30)" -E "lat=44.6 + 0.001 * k + 0.0001 * rand()"
+//   -m "Sortie ####" -E "mission=floor(t / 60)"
+// Fields: lat, lon (degrees), alt (meters), mission and platform (an integer
+// written zero-padded into the run of # characters of the configured
+// string, so the packet layout doesn't change).
+// Expressions use numbers, t (seconds since the start, from the packet's
+// timestamp), n (the stream's packet number, from 0), k (stream index, 0
+// without workers), pi, + - * / % ^ with the
+// usual precedence, parentheses and sin, cos, tan, abs, floor, sqrt, min(a, b),
+// max(a, b) and rand() (uniform 0 to 1, drawn per packet from the stream's
+// own sequence, so streams of different workers don't jitter together).
+//
+// Each expression is compiled once to a compact stack bytecode: one byte
+// per operation, constants by index into a table. The interpreter runs each
+// operation across every packet of a batch before the next one, so
+// dispatch is paid once per batch and the inner loops are plain array
+// arithmetic. Encoded fields patch the batch's checksums with the change in
+// their bytes.
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#define EXPR_FIELD_MAX 5
+#define EXPR_CODE_MAX 256
+#define EXPR_CONSTANT_MAX 64
+#define EXPR_STACK_MAX 16
+
+// Operations, EXPR_CONSTANT is followed by its index
+#define EXPR_CONSTANT 0
+#define EXPR_TIME 1
+#define EXPR_STREAM 2
+#define EXPR_RAND 3
+#define EXPR_ADD 4
+#define EXPR_SUB 5
+#define EXPR_MUL 6
+#define EXPR_DIV 7
+#define EXPR_MOD 8
+#define EXPR_POW 9
+#define EXPR_NEG 10
+#define EXPR_MIN 11
+#define EXPR_MAX 12
+#define EXPR_SIN 13
+#define EXPR_COS 14
+#define EXPR_TAN 15
+#define EXPR_ABS 16
+#define EXPR_FLOOR 17
+#define EXPR_SQRT 18
+#define EXPR_PACKET 19
+
+#define EXPR_FIELD_LATITUDE 0
+#define EXPR_FIELD_LONGITUDE 1
+#define EXPR_FIELD_ALTITUDE 2
+#define EXPR_FIELD_MISSION 3
+#define EXPR_FIELD_PLATFORM 4
+
+//============================================================================
+
+struct exprProgram {
+	unsigned char code[EXPR_CODE_MAX];
+	double constants[EXPR_CONSTANT_MAX];
+	int length;
+	int constantCount;
+	int depth; // Stack entries in use while compiling
+};
+
+// A field driven by an expression
+struct exprField {
+	int kind;
+	const char *source; // "field=expression" as given
+	struct exprProgram program;
+	int offset; // Position of the encoded bytes in a packet
+	int length;
+};
+
+// Per stream state
+struct exprStream {
+	uint64_t random; // splitmix64 state
+	uint64_t packets; // Packets built so far
+};
+
+// Compiler state
+struct exprParser {
+	const char *pos;
+	const char *error;
+	struct exprProgram *program;
+};
+
+// Functions by name and their operations
+const char *exprFunctionNames[] = {"sin", "cos", "tan", "abs", "floor", "sqrt", "min", "max", "rand"};
+const unsigned char exprFunctionOps[] = {EXPR_SIN, EXPR_COS, EXPR_TAN, EXPR_ABS, EXPR_FLOOR, EXPR_SQRT,
+		EXPR_MIN, EXPR_MAX, EXPR_RAND};
+const int exprFunctionArgs[] = {1, 1, 1, 1, 1, 1, 2, 2, 0};
+
+struct exprField exprFields[EXPR_FIELD_MAX];
+int exprFieldCount;
+uint64_t exprEpoch; // Host microseconds of t = 0
+struct exprStream *exprStreams; // The process's streams, from exprFirstStream
+int exprFirstStream;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Appends an operation, tracking the stack depth it leaves
+void exprEmit(struct exprParser *parser, unsigned char op, int depthChange) {
+	struct exprProgram *program = parser->program;
+	if (program->length >= EXPR_CODE_MAX - 1) parser->error = "expression too long";
+	else program->code[program->length++] = op;
+	program->depth += depthChange;
+	if (program->depth > EXPR_STACK_MAX) parser->error = "expression nested too deeply";
+}
+
+//--------------------------------------------------
+// Appends a constant
+void exprEmitConstant(struct exprParser *parser, double value) {
+	struct exprProgram *program = parser->program;
+	if (program->constantCount == EXPR_CONSTANT_MAX) {
+		parser->error = "too many constants";
+		return;
+	}
+	program->constants[program->constantCount] = value;
+	exprEmit(parser, EXPR_CONSTANT, 1);
+	exprEmit(parser, (unsigned char)program->constantCount++, 0);
+}
+
+//--------------------------------------------------
+// Skips spaces and returns the next character
+char exprPeek(struct exprParser *parser) {
+	while (*parser->pos == ' ' || *parser->pos == '\t') parser->pos++;
+	return *parser->pos;
+}
+
+void exprParseSum(struct exprParser *parser);
+void exprParseUnary(struct exprParser *parser);
+
+//--------------------------------------------------
+// Number, variable, function call or parenthesized expression
+void exprParsePrimary(struct exprParser *parser) {
+	char c = exprPeek(parser), *end;
+	const char *name = parser->pos;
+	size_t len;
+	int i, args;
+
+	if (parser->error != NULL) return;
+	if ((c >= '0' && c <= '9') || c == '.') {
+		exprEmitConstant(parser, strtod(parser->pos, &end));
+		parser->pos = end;
+		return;
+	}
+	if (c == '(') {
+		parser->pos++;
+		exprParseSum(parser);
+		if (exprPeek(parser) != ')') parser->error = "expected )";
+		else parser->pos++;
+		return;
+	}
+	for (len = 0; (name[len] >= 'a' && name[len] <= 'z') || (name[len] >= '0' && name[len] <= '9'); ++len);
+	if (len == 0) {
+		parser->error = "expected a value";
+		return;
+	}
+	parser->pos += len;
+	if (len == 1 && name[0] == 't') exprEmit(parser, EXPR_TIME, 1);
+	else if (len == 1 && name[0] == 'n') exprEmit(parser, EXPR_PACKET, 1);
+	else if (len == 1 && name[0] == 'k') exprEmit(parser, EXPR_STREAM, 1);
+	else if (len == 2 && strncmp(name, "pi", 2) == 0) exprEmitConstant(parser, M_PI);
+	else {
+		for (i = 0; i < (int)(sizeof(exprFunctionOps) / sizeof(exprFunctionOps[0])); ++i) {
+			if (strlen(exprFunctionNames[i]) == len && strncmp(name, exprFunctionNames[i], len) == 0) break;
+		}
+		if (i == (int)(sizeof(exprFunctionOps) / sizeof(exprFunctionOps[0]))) {
+			parser->error = "unknown name";
+			parser->pos = name;
+			return;
+		}
+		if (exprPeek(parser) != '(') {
+			parser->error = "expected (";
+			return;
+		}
+		parser->pos++;
+		for (args = 0; exprPeek(parser) != ')' && parser->error == NULL; ++args) {
+			if (args > 0) {
+				if (exprPeek(parser) != ',') {
+					parser->error = "expected , or )";
+					return;
+				}
+				parser->pos++;
+			}
+			exprParseSum(parser);
+		}
+		if (parser->error != NULL) return;
+		parser->pos++;
+		if (args != exprFunctionArgs[i]) {
+			parser->error = "wrong number of arguments";
+			return;
+		}
+		exprEmit(parser, exprFunctionOps[i], 1 - args);
+	}
+}
+
+//--------------------------------------------------
+// Power, right associative
+void exprParsePower(struct exprParser *parser) {
+	exprParsePrimary(parser);
+	if (parser->error == NULL && exprPeek(parser) == '^') {
+		parser->pos++;
+		exprParseUnary(parser);
+		exprEmit(parser, EXPR_POW, -1);
+	}
+}
+
+//--------------------------------------------------
+// Negation
+void exprParseUnary(struct exprParser *parser) {
+	if (exprPeek(parser) == '-') {
+		parser->pos++;
+		exprParseUnary(parser);
+		exprEmit(parser, EXPR_NEG, 0);
+	}
+	else exprParsePower(parser);
+}
+
+//--------------------------------------------------
+// Products
+void exprParseProduct(struct exprParser *parser) {
+	char c;
+	exprParseUnary(parser);
+	while (parser->error == NULL && ((c = exprPeek(parser)) == '*' || c == '/' || c == '%')) {
+		parser->pos++;
+		exprParseUnary(parser);
+		exprEmit(parser, c == '*' ? EXPR_MUL : c == '/' ? EXPR_DIV : EXPR_MOD, -1);
+	}
+}
+
+//--------------------------------------------------
+// Sums
+void exprParseSum(struct exprParser *parser) {
+	char c;
+	exprParseProduct(parser);
+	while (parser->error == NULL && ((c = exprPeek(parser)) == '+' || c == '-')) {
+		parser->pos++;
+		exprParseProduct(parser);
+		exprEmit(parser, c == '+' ? EXPR_ADD : EXPR_SUB, -1);
+	}
+}
+
+//--------------------------------------------------
+// Compiles an expression, returns -1 and prints where it failed if invalid
+int exprCompile(const char *source, struct exprProgram *program) {
+	struct exprParser parser;
+
+	memset(program, 0, sizeof(*program));
+	parser.pos = source;
+	parser.error = NULL;
+	parser.program = program;
+	exprParseSum(&parser);
+	if (parser.error == NULL && exprPeek(&parser) != '\0') parser.error = "unexpected character";
+	if (parser.error != NULL) {
+		printf("ERROR: %s in expression at \"%s\"\n", parser.error, parser.pos);
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Uniform in [0, 1) from a stream's sequence (splitmix64)
+double exprUniform(struct exprStream *stream) {
+	uint64_t z = (stream->random += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return ((z ^ (z >> 31)) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//--------------------------------------------------
+// Runs a program for count packets, one operation across all of them at a
+// time. streams holds each packet's stream state.
+void exprEvaluate(const struct exprProgram *program, const double *t, const double *n, const double *k,
+		struct exprStream **streams, double *out, int count) {
+	double stack[EXPR_STACK_MAX][PACKET_BATCH_MAX];
+	double *a, *b, c;
+	int sp = -1, pc, i;
+
+	for (pc = 0; pc < program->length; ++pc) {
+		switch (program->code[pc]) {
+			case EXPR_CONSTANT:
+				c = program->constants[program->code[++pc]];
+				a = stack[++sp];
+				for (i = 0; i < count; ++i) a[i] = c;
+				break;
+			case EXPR_TIME:
+				memcpy(stack[++sp], t, sizeof(double) * count);
+				break;
+			case EXPR_PACKET:
+				memcpy(stack[++sp], n, sizeof(double) * count);
+				break;
+			case EXPR_STREAM:
+				memcpy(stack[++sp], k, sizeof(double) * count);
+				break;
+			case EXPR_RAND:
+				a = stack[++sp];
+				for (i = 0; i < count; ++i) a[i] = exprUniform(streams[i]);
+				break;
+			case EXPR_NEG:
+				a = stack[sp];
+				for (i = 0; i < count; ++i) a[i] = -a[i];
+				break;
+			case EXPR_SIN:
+				a = stack[sp];
+				for (i = 0; i < count; ++i) a[i] = sin(a[i]);
+				break;
+			case EXPR_COS:
+				a = stack[sp];
+				for (i = 0; i < count; ++i) a[i] = cos(a[i]);
+				break;
+			case EXPR_TAN:
+				a = stack[sp];
+				for (i = 0; i < count; ++i) a[i] = tan(a[i]);
+				break;
+			case EXPR_ABS:
+				a = stack[sp];
+				for (i = 0; i < count; ++i) a[i] = fabs(a[i]);
+				break;
+			case EXPR_FLOOR:
+				a = stack[sp];
+				for (i = 0; i < count; ++i) a[i] = floor(a[i]);
+				break;
+			case EXPR_SQRT:
+				a = stack[sp];
+				for (i = 0; i < count; ++i) a[i] = sqrt(a[i]);
+				break;
+			default:
+				// Binary operations, the result replaces the left operand
+				b = stack[sp--];
+				a = stack[sp];
+				switch (program->code[pc]) {
+					case EXPR_ADD: for (i = 0; i < count; ++i) a[i] += b[i]; break;
+					case EXPR_SUB: for (i = 0; i < count; ++i) a[i] -= b[i]; break;
+					case EXPR_MUL: for (i = 0; i < count; ++i) a[i] *= b[i]; break;
+					case EXPR_DIV: for (i = 0; i < count; ++i) a[i] /= b[i]; break;
+					case EXPR_MOD: for (i = 0; i < count; ++i) a[i] = fmod(a[i], b[i]); break;
+					case EXPR_POW: for (i = 0; i < count; ++i) a[i] = pow(a[i], b[i]); break;
+					case EXPR_MIN: for (i = 0; i < count; ++i) a[i] = a[i] < b[i] ? a[i] : b[i]; break;
+					case EXPR_MAX: for (i = 0; i < count; ++i) a[i] = a[i] > b[i] ? a[i] : b[i]; break;
+				}
+		}
+	}
+	memcpy(out, stack[0], sizeof(double) * count);
+}
+
+//--------------------------------------------------
+// Adds a "field=expression" option, compiled by exprInit(). Returns -1 for
+// an unknown field or too many expressions.
+int exprAddField(const char *source) {
+	const char *names[] = {"lat", "lon", "alt", "mission", "platform"};
+	const char *value = strchr(source, '=');
+	int kind;
+
+	if (value == NULL || exprFieldCount == EXPR_FIELD_MAX) return -1;
+	for (kind = 0; kind < EXPR_FIELD_MAX; ++kind) {
+		if (strlen(names[kind]) == (size_t)(value - source) && strncmp(source, names[kind], value - source) == 0) break;
+	}
+	if (kind == EXPR_FIELD_MAX) return -1;
+	exprFields[exprFieldCount].kind = kind;
+	exprFields[exprFieldCount++].source = source;
+	return 0;
+}
+
+//--------------------------------------------------
+// Finds the run of # in a string field, returns its start or -1
+int exprDigitRun(const char *str, int *length) {
+	const char *run = strchr(str, '#');
+	if (run == NULL) return -1;
+	for (*length = 0; run[*length] == '#'; ++*length);
+	return run - str;
+}
+
+//--------------------------------------------------
+// Sets up the state of the process's streams, first to first + streams - 1.
+// exprInit() sets up stream 0, workers call it again for their own range.
+// Returns -1 if it can't be allocated.
+int exprInitStreams(int first, int streams) {
+	int i;
+
+	if (exprFieldCount == 0) return 0;
+	free(exprStreams);
+	exprStreams = calloc(streams, sizeof(*exprStreams));
+	if (exprStreams == NULL) {
+		printf("ERROR: Unable to allocate expression streams\n");
+		return -1;
+	}
+	for (i = 0; i < streams; ++i) exprStreams[i].random = 0x853C49E6748FEA9BULL + (uint64_t)(first + i);
+	exprFirstStream = first;
+	return 0;
+}
+
+//--------------------------------------------------
+// Compiles the expressions and places their fields in the packet layout, call
+// after initPacketTemplate(). Returns -1 if any is invalid.
+int exprInit(void) {
+	struct exprField *field;
+	int i, run;
+
+	for (i = 0; i < exprFieldCount; ++i) {
+		field = &exprFields[i];
+		if (exprCompile(strchr(field->source, '=') + 1, &field->program) == -1) return -1;
+		switch (field->kind) {
+			case EXPR_FIELD_LATITUDE:
+				field->offset = motionOffset + 2;
+				field->length = 4;
+				break;
+			case EXPR_FIELD_LONGITUDE:
+				field->offset = motionOffset + 8;
+				field->length = 4;
+				break;
+			case EXPR_FIELD_ALTITUDE:
+				field->offset = motionOffset + 14;
+				field->length = 2;
+				break;
+			default:
+				run = exprDigitRun(field->kind == EXPR_FIELD_MISSION ? missionId : platform, &field->length);
+				if (run == -1) {
+					printf("ERROR: The %s needs a run of # for its expression\n",
+							field->kind == EXPR_FIELD_MISSION ? "mission ID" : "platform");
+					return -1;
+				}
+				// Key, BER length, timestamp item, then the mission and platform items
+				field->offset = timestampOffset + 8 + 2 + run + (field->kind == EXPR_FIELD_PLATFORM ? 14 : 0);
+		}
+		if ((field->kind == EXPR_FIELD_LATITUDE || field->kind == EXPR_FIELD_LONGITUDE) && motionLength > 0) {
+			printf("ERROR: The orbit drives lat and lon, they can't also have expressions\n");
+			return -1;
+		}
+	}
+	exprEpoch = updateTimestamp();
+	return exprInitStreams(0, 1);
+}
+
+//--------------------------------------------------
+// Writes a field's value into a packet
+void exprEncode(const struct exprField *field, double value, unsigned char *buff) {
+	uint32_t net32, digits;
+	uint16_t net16;
+	int i;
+
+	// NaN and infinities (sqrt(-1), 0 / 0, 1 / 0) have no encoding, they are written as 0
+	if (!isfinite(value)) value = 0;
+	switch (field->kind) {
+		case EXPR_FIELD_LATITUDE:
+			net32 = htonl((uint32_t)mapSigned(value, 90, 2147483647));
+			memcpy(buff, &net32, 4);
+			break;
+		case EXPR_FIELD_LONGITUDE:
+			if (value > 180 || value < -180) value = fmod(fmod(value + 180, 360) + 360, 360) - 180;
+			net32 = htonl((uint32_t)mapSigned(value, 180, 2147483647));
+			memcpy(buff, &net32, 4);
+			break;
+		case EXPR_FIELD_ALTITUDE:
+			if (value < -900) value = -900;
+			if (value > 19000) value = 19000;
+			net16 = htons((uint16_t)floor((value + 900) / 19900 * 65535 + 0.5));
+			memcpy(buff, &net16, 2);
+			break;
+		default:
+			// Keeps the low digits that fit the run
+			digits = (uint32_t)fmod(fabs(floor(value)), 4294967296.0);
+			for (i = field->length - 1; i >= 0; --i) {
+				buff[i] = '0' + digits % 10;
+				digits /= 10;
+			}
+	}
+}
+
+//--------------------------------------------------
+// Evaluates every field for a batch and writes them, times as given to
+// makePacketBatch() and streams each packet's stream index (NULL = all 0).
+// sums, if not NULL, are adjusted by the change in the fields' bytes.
+void exprApplyBatch(unsigned char **slots, const uint64_t *times, const int *streams, uint16_t *sums, int count) {
+	double t[PACKET_BATCH_MAX], n[PACKET_BATCH_MAX], k[PACKET_BATCH_MAX], values[PACKET_BATCH_MAX];
+	struct exprStream *states[PACKET_BATCH_MAX];
+	struct exprField *field;
+	unsigned char *buff;
+	int f, i;
+
+	for (i = 0; i < count; ++i) {
+		t[i] = (int64_t)(times[i] - exprEpoch) / 1e6;
+		k[i] = streams != NULL ? streams[i] : 0;
+		states[i] = &exprStreams[streams != NULL ? streams[i] - exprFirstStream : 0];
+		n[i] = states[i]->packets++;
+	}
+	for (f = 0; f < exprFieldCount; ++f) {
+		field = &exprFields[f];
+		exprEvaluate(&field->program, t, n, k, states, values, count);
+		for (i = 0; i < count; ++i) {
+			buff = &slots[i][field->offset];
+			if (sums != NULL) sums[i] -= sumBytesAt(buff, field->length, field->offset);
+			exprEncode(field, values[i], buff);
+			if (sums != NULL) sums[i] += sumBytesAt(buff, field->length, field->offset);
+		}
+	}
+}
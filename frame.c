@@ -0,0 +1,213 @@
+//============================================================================
+//		Frame-locked generation
+// Sends one packet per video frame as signaled by the encoder instead of
+// running on klvgen's own clock. Each tick carries the frame number and its
+// PTS (90 kHz MPEG clock), from one of:
+// stdin: one "frame pts" line per tick
+// unix:<path>: one "frame pts" datagram per tick on a Unix socket at path
+// shm:<name>: a POSIX shared memory doorbell (struct frameDoorbell), the
+//   encoder writes frame and pts between two sequence increments, then
+//   wakes the futex on sequence (Linux only)
+//
+// The packet timestamp is the wall clock at the first tick plus the PTS
+// elapsed since it, so metadata stays on the video timeline however late a
+// tick arrives. VMTI frame numbers follow the tick's frame number.
+// Tick-to-send latency, from the tick being read to sendto() returning, is
+// reported every FRAME_STATS_INTERVAL frames and at the end of the input.
+//
+// Example usage: encoder | ./klvgen -F - -a 127.0.0.1 -p 9000
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifndef WIN32
+#include <sys/un.h>
+#ifdef __gnu_linux__
+#	include <linux/futex.h>
+#	include <sys/syscall.h>
+#endif
+
+#define FRAME_PTS_CLOCK 90000 // MPEG system clock, ticks per second
+#define FRAME_PTS_WRAP (1ULL << 33)
+#define FRAME_STATS_INTERVAL 300
+#define FRAME_LATE_NS 100000 // Ticks sent later than this are counted as late
+
+//============================================================================
+
+// Shared memory layout for the shm: source
+struct frameDoorbell {
+	uint32_t sequence; // Odd while the writer is updating, futex word
+	uint32_t reserved;
+	uint64_t frame;
+	uint64_t pts;
+};
+
+char frameSource[256];
+int frameFd = -1;
+FILE *frameInput;
+volatile struct frameDoorbell *frameBell;
+uint32_t frameSequence; // Last doorbell sequence handled
+
+uint64_t frameEpoch; // Wall clock at the first tick, microseconds
+uint64_t frameLastPts;
+int64_t framePtsElapsed; // PTS ticks since the first tick, unwrapped
+
+uint64_t frameTicks;
+uint64_t frameMissed; // Doorbell ticks overwritten before they were read
+uint64_t frameLate;
+uint64_t frameLatencySum;
+uint64_t frameLatencyMax;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Opens the tick source named by frameSource, returns -1 on failure
+int frameOpen(void) {
+	if (strcmp(frameSource, "-") == 0 || strcmp(frameSource, "stdin") == 0) {
+		frameInput = stdin;
+		return 0;
+	}
+	if (strncmp(frameSource, "unix:", 5) == 0) {
+		struct sockaddr_un sun;
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(&frameSource[5]) >= sizeof(sun.sun_path)) {
+			printf("ERROR: Socket path %s is too long\n", &frameSource[5]);
+			return -1;
+		}
+		strcpy(sun.sun_path, &frameSource[5]);
+		unlink(sun.sun_path);
+		frameFd = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (frameFd < 0 || bind(frameFd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+			perror("Unable to bind frame socket");
+			return -1;
+		}
+		return 0;
+	}
+#ifdef __gnu_linux__
+	if (strncmp(frameSource, "shm:", 4) == 0) {
+		int fd = shm_open(&frameSource[4], O_RDWR | O_CREAT, 0666);
+		if (fd < 0 || ftruncate(fd, sizeof(struct frameDoorbell)) != 0) {
+			perror("Unable to open frame doorbell");
+			return -1;
+		}
+		frameBell = mmap(NULL, sizeof(struct frameDoorbell), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (frameBell == MAP_FAILED) {
+			perror("Unable to map frame doorbell");
+			return -1;
+		}
+		frameSequence = __atomic_load_n(&frameBell->sequence, __ATOMIC_ACQUIRE) & ~1u;
+		return 0;
+	}
+#endif
+	printf("ERROR: Unknown frame source %s\n", frameSource);
+	return -1;
+}
+
+//--------------------------------------------------
+// Waits for the next doorbell tick, always returns 1
+#ifdef __gnu_linux__
+int frameWaitDoorbell(uint64_t *frame, uint64_t *pts) {
+	uint32_t sequence;
+	while (1) {
+		sequence = __atomic_load_n(&frameBell->sequence, __ATOMIC_ACQUIRE);
+		if (sequence == frameSequence) {
+			syscall(SYS_futex, &frameBell->sequence, FUTEX_WAIT, sequence, NULL, NULL, 0);
+			continue;
+		}
+		if (sequence & 1) continue; // Writer is mid update
+		*frame = frameBell->frame;
+		*pts = frameBell->pts;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&frameBell->sequence, __ATOMIC_RELAXED) != sequence) continue;
+		frameMissed += (sequence - frameSequence) / 2 - 1;
+		frameSequence = sequence;
+		return 1;
+	}
+}
+#endif
+
+//--------------------------------------------------
+// Reads the next tick, returns 1, or 0 at the end of the input
+int frameNextTick(uint64_t *frame, uint64_t *pts) {
+	char line[128];
+	ssize_t len;
+#ifdef __gnu_linux__
+	if (frameBell != NULL) return frameWaitDoorbell(frame, pts);
+#endif
+	while (1) {
+		if (frameInput != NULL) {
+			if (fgets(line, sizeof(line), frameInput) == NULL) return 0;
+		}
+		else {
+			len = recv(frameFd, line, sizeof(line) - 1, 0);
+			if (len < 0) {
+				if (errno == EINTR) continue;
+				perror("Error reading frame socket");
+				return 0;
+			}
+			line[len] = '\0';
+		}
+		if (sscanf(line, "%" SCNu64 " %" SCNu64, frame, pts) == 2) return 1;
+		printf("WARNING: Ignoring malformed frame tick: %s\n", line);
+	}
+}
+
+//--------------------------------------------------
+// UNIX time in microseconds for a tick's PTS, following 33-bit wraps
+uint64_t framePtsTime(uint64_t pts) {
+	uint64_t delta;
+	if (frameTicks == 0) {
+		frameEpoch = updateTimestamp();
+		framePtsElapsed = 0;
+	}
+	else {
+		delta = (pts - frameLastPts) & (FRAME_PTS_WRAP - 1);
+		// Steps of more than half the range are the PTS going backwards
+		framePtsElapsed += delta < FRAME_PTS_WRAP / 2 ? (int64_t)delta : (int64_t)delta - (int64_t)FRAME_PTS_WRAP;
+	}
+	frameLastPts = pts;
+	return frameEpoch + framePtsElapsed * 1000000 / FRAME_PTS_CLOCK;
+}
+
+//--------------------------------------------------
+// Prints the frame counts and tick-to-send latency
+void framePrintStats(void) {
+	printf("Frames: %llu, latency avg %.1f us, max %.1f us, over %d us: %llu, missed: %llu\n",
+			(unsigned long long)frameTicks, frameTicks ? frameLatencySum / 1e3 / frameTicks : 0.0,
+			frameLatencyMax / 1e3, FRAME_LATE_NS / 1000, (unsigned long long)frameLate,
+			(unsigned long long)frameMissed);
+	fflush(stdout);
+}
+
+//--------------------------------------------------
+// Sends a packet per tick until the input ends, returns -1 on error
+int frameRun(void) {
+	uint64_t frame, pts, received, latency;
+
+	if (frameOpen() == -1) return -1;
+	printf("Waiting for frame ticks from %s\n", frameSource);
+	while (frameNextTick(&frame, &pts) == 1) {
+		received = monotonicNanoseconds();
+#ifdef __gnu_linux__
+		txstampScheduled = received;
+#endif
+		timestamp = htonll(framePtsTime(pts));
+		vmtiFrame = (uint32_t)frame;
+		makePacket(packetBuffer);
+		if (udpSendPacket((const char *)packetBuffer) == -1) return -1;
+		latency = monotonicNanoseconds() - received;
+
+		frameTicks++;
+		frameLatencySum += latency;
+		if (latency > frameLatencyMax) frameLatencyMax = latency;
+		if (latency > FRAME_LATE_NS) frameLate++;
+		if (frameTicks % FRAME_STATS_INTERVAL == 0) framePrintStats();
+	}
+	framePrintStats();
+	if (frameFd >= 0 && strncmp(frameSource, "unix:", 5) == 0) unlink(&frameSource[5]);
+	return 0;
+}
+#endif
@@ -0,0 +1,186 @@
+//============================================================================
+//		Sensor footprint geometry
+// Intersects the sensor line of sight with the terrain to produce the
+// ST 0601 image geometry tags:
+// Sensor Horizontal/Vertical Field of View (16, 17)
+// Frame Center Latitude/Longitude/Elevation (23-25): where the line of sight
+//   meets the terrain
+// Offset Corner Latitude/Longitude Points 1-4 (26-33): the image corners,
+//   upper left clockwise, relative to the frame center
+//
+// The line of sight comes from the platform heading, pitch and roll and the
+// sensor relative angles (see motion.c); a stationary platform looks
+// straight down. Rays are marched over a local tangent plane with the
+// earth's curvature applied, in FOOTPRINT_STEP increments, and the crossing
+// is refined by bisection. Each ray starts from its previous slant range, so
+// from one packet to the next only a few terrain lookups are needed. Rays
+// that miss the terrain get the error indicators.
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#define FOOTPRINT_STEP 30.0 // Meters, about one SRTM 1 arc-second posting
+#define FOOTPRINT_RANGE_MAX 100000.0
+#define FOOTPRINT_BISECTIONS 16
+#define FOOTPRINT_CORNER_RANGE 0.075 // Degrees, range of the corner offset tags
+#define FOOTPRINT_RAYS 5 // Frame center, then corners 1-4
+
+//============================================================================
+
+// A line of sight from the platform, dir is a unit vector north, east, down
+struct footprintRay {
+	double lat;
+	double lon;
+	double alt;
+	double lonScale; // Meters east to degrees of longitude
+	double dir[3];
+};
+
+double sensorHorizontalFov; // Degrees, 0 = no footprint tags
+double sensorVerticalFov;
+unsigned char footprintSet[64]; // Tags 16, 17 and 23-33
+int footprintSetLength;
+double footprintRanges[FOOTPRINT_RAYS]; // Previous slant range of each ray, 0 = none yet
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Unit ray in north, east, down from the platform attitude and sensor
+// relative angles (degrees). right and up offset it across the image plane,
+// in units of the boresight distance (tan of the angle off boresight).
+void sensorDirection(double heading, double pitch, double roll, double azimuth, double elevation,
+		double right, double up, double dir[3]) {
+	double ch = cos(heading * MOTION_RADIANS), sh = sin(heading * MOTION_RADIANS);
+	double cp = cos(pitch * MOTION_RADIANS), sp = sin(pitch * MOTION_RADIANS);
+	double cr = cos(roll * MOTION_RADIANS), sr = sin(roll * MOTION_RADIANS);
+	double ca = cos(azimuth * MOTION_RADIANS), sa = sin(azimuth * MOTION_RADIANS);
+	double ce = cos(elevation * MOTION_RADIANS), se = sin(elevation * MOTION_RADIANS);
+	// Boresight, plus the image right (level) and up axes, in the body frame
+	double x = ce * ca - right * sa - up * se * ca;
+	double y = ce * sa + right * ca - up * se * sa;
+	double z = -se - up * ce;
+	double norm = sqrt(x * x + y * y + z * z);
+	double y1, z1, x2, z2;
+
+	x /= norm;
+	y /= norm;
+	z /= norm;
+	// Body x forward, y right, z down: roll about x, pitch about y, then heading about z
+	y1 = cr * y - sr * z;
+	z1 = sr * y + cr * z;
+	x2 = cp * x + sp * z1;
+	z2 = -sp * x + cp * z1;
+	dir[0] = ch * x2 - sh * y1;
+	dir[1] = sh * x2 + ch * y1;
+	dir[2] = z2;
+}
+
+//--------------------------------------------------
+// Height of a ray above the terrain at a slant range, and the position there
+double footprintClearance(const struct footprintRay *ray, double range, double *lat, double *lon) {
+	double north = range * ray->dir[0], east = range * ray->dir[1];
+	// The ground falls away from the tangent plane with distance
+	double height = ray->alt - range * ray->dir[2] + (north * north + east * east) / (2 * MOTION_EARTH_RADIUS);
+	*lat = ray->lat + north / (MOTION_EARTH_RADIUS * MOTION_RADIANS);
+	*lon = ray->lon + east * ray->lonScale;
+	return height - demElevation(*lat, *lon);
+}
+
+//--------------------------------------------------
+// Slant range to the first terrain crossing, searching from start (0 = from
+// the platform). Returns -1 if the ray misses within FOOTPRINT_RANGE_MAX.
+double footprintIntersect(const struct footprintRay *ray, double start, double *lat, double *lon) {
+	double above, below, mid;
+	int i;
+
+	if (footprintClearance(ray, 0, lat, lon) <= 0) return -1;
+	if (start <= 0 || footprintClearance(ray, start, lat, lon) > 0) {
+		// March out until the ray is below the terrain
+		for (above = start > 0 ? start : 0; ; above += FOOTPRINT_STEP) {
+			if (above + FOOTPRINT_STEP > FOOTPRINT_RANGE_MAX) return -1;
+			if (footprintClearance(ray, above + FOOTPRINT_STEP, lat, lon) <= 0) break;
+		}
+		below = above + FOOTPRINT_STEP;
+	}
+	else {
+		// Already below, march back toward the platform
+		for (below = start; ; below -= FOOTPRINT_STEP) {
+			above = below > FOOTPRINT_STEP ? below - FOOTPRINT_STEP : 0;
+			if (above == 0 || footprintClearance(ray, above, lat, lon) > 0) break;
+		}
+	}
+	for (i = 0; i < FOOTPRINT_BISECTIONS; ++i) {
+		mid = (above + below) / 2;
+		if (footprintClearance(ray, mid, lat, lon) > 0) above = mid;
+		else below = mid;
+	}
+	footprintClearance(ray, below, lat, lon);
+	return below;
+}
+
+//--------------------------------------------------
+// Maps a corner's offset from the frame center, error indicator if it
+// missed or is out of range
+uint16_t mapCornerOffset(double offset, int valid) {
+	if (!valid || offset < -FOOTPRINT_CORNER_RANGE || offset > FOOTPRINT_CORNER_RANGE) return 0x8000;
+	return (uint16_t)mapSigned(offset, FOOTPRINT_CORNER_RANGE, 32767);
+}
+
+//--------------------------------------------------
+// Writes the footprint tags for a platform position and heading, with the
+// remaining angles from motion.c. Returns the position after them.
+int writeFootprint(unsigned char *buff, double lat, double lon, double heading) {
+	// Image corners in half fields of view, upper left clockwise
+	const double rightOffset[FOOTPRINT_RAYS] = {0, -1, 1, 1, -1};
+	const double upOffset[FOOTPRINT_RAYS] = {0, 1, 1, -1, -1};
+	double halfRight = tan(sensorHorizontalFov / 2 * MOTION_RADIANS);
+	double halfUp = tan(sensorVerticalFov / 2 * MOTION_RADIANS);
+	double hitLat[FOOTPRINT_RAYS], hitLon[FOOTPRINT_RAYS];
+	int hit[FOOTPRINT_RAYS];
+	struct footprintRay ray;
+	double elevation = 0;
+	int pos = 0, i;
+
+	ray.lat = lat;
+	ray.lon = lon;
+	ray.alt = altitudeMeters;
+	ray.lonScale = 1 / (MOTION_EARTH_RADIUS * cos(lat * MOTION_RADIANS) * MOTION_RADIANS);
+	for (i = 0; i < FOOTPRINT_RAYS; ++i) {
+		sensorDirection(heading, 0, motionRoll, motionSensorAzimuth, motionSensorElevation,
+				rightOffset[i] * halfRight, upOffset[i] * halfUp, ray.dir);
+		footprintRanges[i] = footprintIntersect(&ray, footprintRanges[i], &hitLat[i], &hitLon[i]);
+		hit[i] = footprintRanges[i] > 0;
+		if (!hit[i]) footprintRanges[i] = 0;
+	}
+	if (hit[0]) elevation = demElevation(hitLat[0], hitLon[0]);
+
+	pos = appendUintItem(buff, pos, 0x10, (uint16_t)floor(sensorHorizontalFov / 180 * 65535 + 0.5), 2);
+	pos = appendUintItem(buff, pos, 0x11, (uint16_t)floor(sensorVerticalFov / 180 * 65535 + 0.5), 2);
+	pos = appendUintItem(buff, pos, 0x17, hit[0] ? (uint32_t)mapSigned(hitLat[0], 90, 2147483647) : 0x80000000, 4);
+	pos = appendUintItem(buff, pos, 0x18, hit[0] ? (uint32_t)mapSigned(hitLon[0], 180, 2147483647) : 0x80000000, 4);
+	pos = appendUintItem(buff, pos, 0x19, (uint16_t)floor((elevation + 900) / 19900 * 65535 + 0.5), 2);
+	for (i = 1; i < FOOTPRINT_RAYS; ++i) {
+		pos = appendUintItem(buff, pos, 0x1A + 2 * (i - 1), mapCornerOffset(hitLat[i] - hitLat[0], hit[0] && hit[i]), 2);
+		pos = appendUintItem(buff, pos, 0x1B + 2 * (i - 1), mapCornerOffset(hitLon[i] - hitLon[0], hit[0] && hit[i]), 2);
+	}
+	return pos;
+}
+
+//--------------------------------------------------
+// Encode the footprint tags for the starting position, the orbit updates
+// them through updateFootprintSet()
+void encodeFootprintSet(void) {
+	int i;
+	footprintSetLength = 0;
+	if (sensorHorizontalFov <= 0) return;
+	for (i = 0; i < FOOTPRINT_RAYS; ++i) footprintRanges[i] = 0;
+	footprintSetLength = writeFootprint(footprintSet, latitudeDegrees + (orbitRadius > 0 ?
+			orbitRadius / (MOTION_EARTH_RADIUS * MOTION_RADIANS) : 0), longitudeDegrees, orbitRadius > 0 ? 90 : 0);
+}
+
+//--------------------------------------------------
+// Traces the footprint again for a new platform position and heading
+void updateFootprintSet(double lat, double lon, double heading) {
+	writeFootprint(footprintSet, lat, lon, heading);
+}
@@ -0,0 +1,134 @@
+//============================================================================
+//		IMAPB floating point mapping
+// Encodes and decodes values with the MISB ST 1201 IMAPB(a, b, L) mapping of
+// a floating point range [a, b] onto an L byte integer, used by ST 0903 and
+// the newer ST 0601 tags:
+// bPow = ceil(log2(b - a)), dPow = 8L - 1
+// sF = 2^(dPow - bPow), sR = 2^(bPow - dPow)
+// zOffset = sF * a - floor(sF * a) when a < 0 < b, otherwise 0
+// Forward: y = floor(sF * (x - a) + zOffset)
+// Reverse: x = sR * (y - zOffset) + a
+//
+// The parameters are computed once per field with imapbInit(). The array
+// versions handle fields of up to 4 bytes as plain loops the compiler can
+// vectorize, with special values (infinity, NaN) patched in afterwards.
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+// First byte of the ST 1201 special values, the remaining bytes are zero
+#define IMAPB_POSITIVE_INFINITY 0xC8
+#define IMAPB_NEGATIVE_INFINITY 0xE8
+#define IMAPB_POSITIVE_QUIET_NAN 0xD0
+#define IMAPB_NEGATIVE_QUIET_NAN 0xF0
+
+//============================================================================
+
+// Precomputed mapping for one field
+struct imapbParams {
+	double a;
+	double b;
+	int length; // Bytes
+	int bPow;
+	int dPow;
+	double sF;
+	double sR;
+	double zOffset;
+	double yMax; // Integer b maps to, values above are clamped to it
+};
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Precompute the IMAPB(a, b, length) parameters for a field
+void imapbInit(struct imapbParams *p, double a, double b, int length) {
+	p->a = a;
+	p->b = b;
+	p->length = length;
+	p->bPow = (int)ceil(log2(b - a));
+	p->dPow = 8 * length - 1;
+	p->sF = ldexp(1.0, p->dPow - p->bPow);
+	p->sR = ldexp(1.0, p->bPow - p->dPow);
+	p->zOffset = (a < 0 && b > 0) ? p->sF * a - floor(p->sF * a) : 0.0;
+	p->yMax = floor(p->sF * (b - a) + p->zOffset);
+}
+
+//--------------------------------------------------
+// Integer holding a special value's first byte in the field's top byte
+uint64_t imapbSpecial(const struct imapbParams *p, double x) {
+	unsigned char first;
+	if (isnan(x)) first = signbit(x) ? IMAPB_NEGATIVE_QUIET_NAN : IMAPB_POSITIVE_QUIET_NAN;
+	else first = x > 0 ? IMAPB_POSITIVE_INFINITY : IMAPB_NEGATIVE_INFINITY;
+	return (uint64_t)first << (8 * (p->length - 1));
+}
+
+//--------------------------------------------------
+// Map a value to its integer, finite values outside [a, b] are clamped
+uint64_t imapbEncode(const struct imapbParams *p, double x) {
+	double y;
+	if (!isfinite(x)) return imapbSpecial(p, x);
+	y = floor(p->sF * (x - p->a) + p->zOffset);
+	if (y < 0) y = 0;
+	if (y > p->yMax) y = p->yMax;
+	return (uint64_t)y;
+}
+
+//--------------------------------------------------
+// Map an integer back to its value, special values decode to infinity or NaN
+double imapbDecode(const struct imapbParams *p, uint64_t y) {
+	unsigned char first = (y >> (8 * (p->length - 1))) & 0xFF;
+	if ((first & 0xC0) == 0xC0) {
+		if (first == IMAPB_POSITIVE_INFINITY) return INFINITY;
+		if (first == IMAPB_NEGATIVE_INFINITY) return -INFINITY;
+		return (first & 0x20) ? -NAN : NAN;
+	}
+	return p->sR * ((double)y - p->zOffset) + p->a;
+}
+
+//--------------------------------------------------
+// Write a value as length big-endian bytes, returns the position after them
+int imapbWrite(const struct imapbParams *p, double x, unsigned char *buff, int pos) {
+	uint64_t y = imapbEncode(p, x);
+	int i;
+	for (i = p->length - 1; i >= 0; --i, y >>= 8) buff[pos + i] = y & 0xFF;
+	return pos + p->length;
+}
+
+//--------------------------------------------------
+// Read a field of length big-endian bytes and map it back to its value
+double imapbRead(const struct imapbParams *p, const unsigned char *buff) {
+	uint64_t y = 0;
+	int i;
+	for (i = 0; i < p->length; ++i) y = (y << 8) | buff[i];
+	return imapbDecode(p, y);
+}
+
+//--------------------------------------------------
+// Map count values of a field of at most 4 bytes, results in host order
+void imapbEncodeArray(const struct imapbParams *p, const double *x, uint32_t *y, int count) {
+	const double a = p->a, sF = p->sF, zOffset = p->zOffset, yMax = p->yMax;
+	int i;
+	for (i = 0; i < count; ++i) {
+		double v = sF * (x[i] - a) + zOffset;
+		v = !(v >= 0) ? 0 : v; // NaN goes to 0 here and is patched below
+		v = v > yMax ? yMax : v;
+		y[i] = (uint32_t)v;
+	}
+	for (i = 0; i < count; ++i) {
+		if (!isfinite(x[i])) y[i] = (uint32_t)imapbSpecial(p, x[i]);
+	}
+}
+
+//--------------------------------------------------
+// Map count integers of a field of at most 4 bytes back to their values
+void imapbDecodeArray(const struct imapbParams *p, const uint32_t *y, double *x, int count) {
+	const double a = p->a, sR = p->sR, zOffset = p->zOffset;
+	const uint32_t specialMask = 0xC0u << (8 * (p->length - 1));
+	int i;
+	for (i = 0; i < count; ++i)
+		x[i] = sR * ((double)y[i] - zOffset) + a;
+	for (i = 0; i < count; ++i) {
+		if ((y[i] & specialMask) == specialMask) x[i] = imapbDecode(p, y[i]);
+	}
+}
@@ -0,0 +1,334 @@
+//============================================================================
+//		Capture time index
+// Lets replay start anywhere in a capture of tens of GB without scanning
+// up to it. The index is a sidecar file, <capture>.kidx, built by one pass
+// with the replay reader (the key scanner for raw .klv, the record walk for
+// pcap): -i <seconds> builds it at that granularity, and replay builds it
+// with INDEX_GRANULARITY when asked to seek and it is missing or older than
+// the capture.
+//
+// The index has a list of entries for all packets and one per platform
+// (mission ID and platform, tags 3 and 10). A list gets an entry, in file
+// order, for the first of its packets in each granule of time:
+// offset: where the packet (its pcap record) starts
+// time: its embedded timestamp (raw) or capture time (pcap), microseconds
+// maxBefore: the latest time of the list's packets before offset
+// maxBefore never decreases along a list, so klvIndexSeek() finds the last
+// entry before which every packet is older than the time with a binary
+// search, even if streams are interleaved slightly out of order. Entries
+// are 24 bytes, an hour of 100 platforms at one second granularity is
+// under 20 MB.
+//
+// klvIndexRangeStart() and klvIndexRangeNext() read the packets of a list
+// from one time up to another: from the seek offset, skipping older ones and
+// other platforms, until the first packet at or after the end time.
+//
+// Example usage: ./klvgen -f capture.klv -o +600 -u +660 -a 127.0.0.1 -p 9000
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifndef WIN32
+#define INDEX_VERSION 1
+#define INDEX_GRANULARITY 1000000ULL // Microseconds, when replay builds the index
+#define INDEX_NAME_MAX 32
+#define INDEX_PLATFORM_MAX 65536 // Lists besides the one of all packets
+#define INDEX_HASH_SIZE (1 << 17) // Build lookup slots, a power of 2 over twice the lists
+
+//============================================================================
+
+// Start of the sidecar file, followed by the lists and the entries
+struct indexHeader {
+	char magic[8]; // "KLVINDEX"
+	uint32_t version;
+	uint32_t lists; // Including list 0, all packets
+	uint64_t entries;
+	uint64_t granularity; // Microseconds
+	uint64_t sourceSize; // Capture the index was built from
+	int64_t sourceModified; // Seconds
+	uint64_t firstTime;
+	uint64_t lastTime;
+};
+
+// A platform's entries are entries[first] to entries[first + count - 1]
+struct indexList {
+	uint64_t key; // Hash of mission and platform, 0 for list 0
+	char mission[INDEX_NAME_MAX];
+	char platform[INDEX_NAME_MAX];
+	uint64_t first;
+	uint64_t count;
+	uint64_t lastGranule; // Used while building
+	uint64_t maxTime;
+};
+
+struct indexEntry {
+	uint64_t offset;
+	uint64_t time;
+	uint64_t maxBefore;
+};
+
+uint64_t indexBuildGranularity; // Set by -i, 0 = don't build on its own
+char indexFrom[32]; // Replay range, UNIX seconds or +seconds from the first packet
+char indexUntil[32];
+
+const unsigned char *indexMap;
+size_t indexSize;
+const struct indexHeader *indexHead;
+const struct indexList *indexLists;
+const struct indexEntry *indexEntries;
+
+// Active range, the whole file by default
+int indexRangeList;
+uint64_t indexRangeFrom;
+uint64_t indexRangeUntil = UINT64_MAX;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Hashes a packet's mission and platform (FNV-1a), never 0, and copies the
+// names if wanted
+uint64_t indexKey(const struct klvPacket *pkt, char *mission, char *platform) {
+	const struct klvView *views[2] = {klvFind(pkt, 0x03), klvFind(pkt, 0x0A)};
+	char *names[2] = {mission, platform};
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	uint32_t i, n, length;
+
+	for (n = 0; n < 2; ++n) {
+		length = views[n] != NULL ? views[n]->length : 0;
+		for (i = 0; i < length; ++i) hash = (hash ^ pkt->buff[views[n]->offset + i]) * 0x100000001B3ULL;
+		hash = (hash ^ 0x100) * 0x100000001B3ULL;
+		if (names[n] != NULL) {
+			if (length > INDEX_NAME_MAX - 1) length = INDEX_NAME_MAX - 1;
+			memset(names[n], 0, INDEX_NAME_MAX);
+			if (length > 0) memcpy(names[n], &pkt->buff[views[n]->offset], length);
+		}
+	}
+	return hash != 0 ? hash : 1;
+}
+
+//--------------------------------------------------
+// Name of the sidecar file of the replay file
+void indexPath(char *path, size_t size) {
+	snprintf(path, size, "%s.kidx", replayFile);
+}
+
+//--------------------------------------------------
+// Adds an entry to a list if the packet starts a new granule
+int indexAdd(struct indexList *list, int id, uint64_t offset, uint64_t time, uint64_t granularity,
+		struct indexEntry **entries, uint32_t **owners, uint64_t *count, uint64_t *capacity) {
+	if (list->count == 0 || time / granularity != list->lastGranule) {
+		if (*count == *capacity) {
+			*capacity = *capacity > 0 ? *capacity * 2 : 65536;
+			*entries = realloc(*entries, sizeof(**entries) * *capacity);
+			*owners = realloc(*owners, sizeof(**owners) * *capacity);
+			if (*entries == NULL || *owners == NULL) return -1;
+		}
+		(*entries)[*count].offset = offset;
+		(*entries)[*count].time = time;
+		(*entries)[*count].maxBefore = list->maxTime;
+		(*owners)[(*count)++] = id;
+		list->lastGranule = time / granularity;
+		list->count++;
+	}
+	if (time > list->maxTime) list->maxTime = time;
+	return 0;
+}
+
+//--------------------------------------------------
+// Scans the open replay file and writes its index, returns -1 on failure
+int klvIndexBuild(uint64_t granularity) {
+	struct indexHeader header;
+	struct indexList *lists;
+	struct indexEntry *entries = NULL, *sorted;
+	uint32_t *owners = NULL, *slots, slot;
+	uint64_t count = 0, capacity = 0, packets = 0, time, key, *next;
+	struct klvPacket pkt;
+	struct stat st;
+	char path[300];
+	FILE *out;
+	int listCount = 1, i;
+
+	lists = calloc(INDEX_PLATFORM_MAX + 1, sizeof(*lists));
+	slots = calloc(INDEX_HASH_SIZE, sizeof(*slots));
+	if (lists == NULL || slots == NULL) {
+		printf("ERROR: Unable to allocate the index\n");
+		return -1;
+	}
+	memset(&header, 0, sizeof(header));
+	replayPos = replayIsPcap ? 24 : 0;
+	while (replayNext(&pkt, &time)) {
+		if (packets++ == 0) header.firstTime = time;
+		if (time > header.lastTime) header.lastTime = time;
+		if (indexAdd(&lists[0], 0, replayRecord, time, granularity, &entries, &owners, &count, &capacity) == -1) break;
+
+		// Platform lists by open addressing on the key, slots hold list numbers
+		key = indexKey(&pkt, NULL, NULL);
+		for (slot = key & (INDEX_HASH_SIZE - 1); slots[slot] != 0 && lists[slots[slot]].key != key;
+				slot = (slot + 1) & (INDEX_HASH_SIZE - 1));
+		if (slots[slot] == 0) {
+			if (listCount == INDEX_PLATFORM_MAX + 1) continue; // Only the list of all packets has it
+			slots[slot] = listCount;
+			lists[listCount].key = indexKey(&pkt, lists[listCount].mission, lists[listCount].platform);
+			listCount++;
+		}
+		if (indexAdd(&lists[slots[slot]], slots[slot], replayRecord, time, granularity, &entries, &owners, &count,
+				&capacity) == -1) break;
+	}
+	if (packets > 0 && (entries == NULL || owners == NULL)) {
+		printf("ERROR: Unable to allocate the index\n");
+		return -1;
+	}
+
+	// Entries were added in file order, grouping them by list keeps each list's in order
+	sorted = malloc(sizeof(*sorted) * (count > 0 ? count : 1));
+	next = malloc(sizeof(*next) * listCount);
+	if (sorted == NULL || next == NULL) {
+		printf("ERROR: Unable to allocate the index\n");
+		return -1;
+	}
+	for (i = 0; i < listCount; ++i) {
+		lists[i].first = i == 0 ? 0 : lists[i - 1].first + lists[i - 1].count;
+		next[i] = lists[i].first;
+	}
+	for (time = 0; time < count; ++time) sorted[next[owners[time]]++] = entries[time];
+
+	memcpy(header.magic, "KLVINDEX", 8);
+	header.version = INDEX_VERSION;
+	header.lists = listCount;
+	header.entries = count;
+	header.granularity = granularity;
+	stat(replayFile, &st);
+	header.sourceSize = st.st_size;
+	header.sourceModified = st.st_mtime;
+	indexPath(path, sizeof(path));
+	out = fopen(path, "wb");
+	if (out == NULL || fwrite(&header, sizeof(header), 1, out) != 1 ||
+			fwrite(lists, sizeof(*lists), listCount, out) != (size_t)listCount ||
+			fwrite(sorted, sizeof(*sorted), count, out) != count) {
+		perror("Unable to write index");
+		if (out != NULL) fclose(out);
+		return -1;
+	}
+	fclose(out);
+	printf("Indexed %llu packets of %d platforms, %llu entries at %.3f s, in %s\n", (unsigned long long)packets,
+			listCount - 1, (unsigned long long)count, granularity / 1e6, path);
+	free(lists);
+	free(slots);
+	free(entries);
+	free(owners);
+	free(sorted);
+	free(next);
+	return 0;
+}
+
+//--------------------------------------------------
+// Maps the replay file's index, returns -1 if there is none or it is stale
+int klvIndexOpen(void) {
+	struct stat st, source;
+	char path[300];
+	int fd;
+
+	indexPath(path, sizeof(path));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct indexHeader) || stat(replayFile, &source) != 0) {
+		close(fd);
+		return -1;
+	}
+	indexSize = st.st_size;
+	indexMap = mmap(NULL, indexSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (indexMap == MAP_FAILED) {
+		indexMap = NULL;
+		return -1;
+	}
+	indexHead = (const struct indexHeader *)indexMap;
+	indexLists = (const struct indexList *)&indexHead[1];
+	indexEntries = (const struct indexEntry *)&indexLists[indexHead->lists];
+	if (memcmp(indexHead->magic, "KLVINDEX", 8) != 0 || indexHead->version != INDEX_VERSION ||
+			indexSize != sizeof(struct indexHeader) + indexHead->lists * sizeof(struct indexList) +
+			indexHead->entries * sizeof(struct indexEntry) ||
+			indexHead->sourceSize != (uint64_t)source.st_size || indexHead->sourceModified != source.st_mtime) {
+		munmap((void *)indexMap, indexSize);
+		indexMap = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Finds a platform's list, returns -1 if the capture doesn't have it
+int klvIndexFind(const char *mission, const char *platform) {
+	uint32_t i;
+	for (i = 1; i < indexHead->lists; ++i) {
+		if (strcmp(indexLists[i].mission, mission) == 0 && strcmp(indexLists[i].platform, platform) == 0) return i;
+	}
+	return -1;
+}
+
+//--------------------------------------------------
+// File offset to read a list from to see all its packets at or after time
+uint64_t klvIndexSeek(int list, uint64_t time) {
+	const struct indexEntry *entries = &indexEntries[indexLists[list].first];
+	uint64_t low = 0, high = indexLists[list].count, mid;
+
+	if (high == 0) return replaySize;
+	// Last entry with everything before it older than time
+	while (high - low > 1) {
+		mid = low + (high - low) / 2;
+		if (entries[mid].maxBefore < time) low = mid;
+		else high = mid;
+	}
+	return entries[low].offset;
+}
+
+//--------------------------------------------------
+// Positions the replay file to read a list's packets from one time up to
+// another, microseconds
+void klvIndexRangeStart(int list, uint64_t from, uint64_t until) {
+	indexRangeList = list;
+	indexRangeFrom = from;
+	indexRangeUntil = until;
+	replayPos = klvIndexSeek(list, from);
+}
+
+//--------------------------------------------------
+// Reads the next packet of the active range, as replayNext(). Without a
+// range it reads the whole file.
+int klvIndexRangeNext(struct klvPacket *pkt, uint64_t *time) {
+	while (replayNext(pkt, time)) {
+		if (indexRangeList > 0 && indexKey(pkt, NULL, NULL) != indexLists[indexRangeList].key) continue;
+		if (*time < indexRangeFrom) continue;
+		return *time < indexRangeUntil;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Parses a range time, UNIX seconds or +seconds from the first packet
+uint64_t indexParseTime(const char *str) {
+	if (str[0] == '+') return indexHead->firstTime + (uint64_t)(atof(&str[1]) * 1e6);
+	return (uint64_t)(atof(str) * 1e6);
+}
+
+//--------------------------------------------------
+// Seeks the open replay file to the -o/-u range, building the index if it
+// has none. Returns -1 on failure.
+int klvIndexReplayRange(void) {
+	uint64_t start;
+
+	if (klvIndexOpen() == -1) {
+		printf("Indexing %s\n", replayFile);
+		if (klvIndexBuild(INDEX_GRANULARITY) == -1 || klvIndexOpen() == -1) {
+			printf("ERROR: Unable to index %s\n", replayFile);
+			return -1;
+		}
+	}
+	start = monotonicNanoseconds();
+	klvIndexRangeStart(0, indexFrom[0] != '\0' ? indexParseTime(indexFrom) : 0,
+			indexUntil[0] != '\0' ? indexParseTime(indexUntil) : UINT64_MAX);
+	printf("Seeked to offset %llu in %.1f us\n", (unsigned long long)replayPos, (monotonicNanoseconds() - start) / 1e3);
+	return 0;
+}
+#endif
@@ -25,6 +25,10 @@
 // All rights reserved
 //============================================================================
 
+#ifndef _GNU_SOURCE
+#	define _GNU_SOURCE // sendmmsg
+#endif
+#include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <math.h>
@@ -44,10 +48,30 @@
 #	include <netinet/in.h>
 #	include <sys/socket.h>
 #endif
+#ifdef __gnu_linux__
+#	include <netinet/udp.h>
+#	ifndef SOL_UDP
+#		define SOL_UDP 17
+#	endif
+#	ifndef UDP_SEGMENT
+#		define UDP_SEGMENT 103
+#	endif
+#endif
 #ifdef __MACH__
 #   include <mach/clock.h>
 #   include <mach/mach.h>
 #endif
+#if (defined __x86_64__ || defined __i386__) && (defined __GNUC__)
+#	include <tmmintrin.h>
+#	define KLV_HAVE_SSSE3
+#endif
+
+// Byte order resolved at compile time where the compiler reports it
+#if (defined __BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#	define KLV_BIG_ENDIAN 1
+#elif (defined __BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#	define KLV_BIG_ENDIAN 0
+#endif
 
 //============================================================================
 
@@ -56,6 +80,40 @@ char missionId[13];
 char platform[13];
 int DEBUG;
 float sendRate;
+uint64_t rateNumerator = 1; // Exact rate, rateNumerator packets per rateDenominator seconds
+uint64_t rateDenominator = 1;
+int startBoundary; // Seconds, the first packet waits for a wall clock multiple of this, 0 = start now
+int phaseSlot; // Packets go out phaseSlot/phaseSlots of a period after each tick
+int phaseSlots = 1;
+
+// Absolute send deadlines at the exact rate, packet N is due
+// N * rateDenominator / rateNumerator seconds after the first
+struct ratePacer {
+	uint64_t deadline; // Monotonic nanoseconds
+	uint64_t period; // Whole nanoseconds between packets
+	uint64_t remainder; // Fraction of a nanosecond left over per packet, in 1/numerator
+	uint64_t carry;
+	uint64_t numerator; // Rate, packets per second as a fraction
+	uint64_t denominator;
+};
+
+// On-wire size of a UDP payload over IPv4 and Ethernet
+#define WIRE_UDP_HEADER 8
+#define WIRE_IP_HEADER 20
+#define WIRE_FRAME_OVERHEAD 38 // Ethernet header 14, FCS 4, preamble 8, interframe gap 12
+#define WIRE_FRAME_MIN 46 // Smallest Ethernet payload, shorter frames are padded
+#define WIRE_FRAGMENT 1480 // IP payload per fragment at a 1500 byte MTU
+#define BITRATE_BURST 1000000ULL // Nanoseconds of traffic sent per batch at a bit rate
+
+// Token bucket of on-wire bytes filled at bitRate. It is kept as the time the
+// bytes taken so far are paid for, so like ratePacer no error accumulates.
+struct byteBucket {
+	uint64_t deadline; // Monotonic nanoseconds when the bucket is empty again
+	uint64_t carry; // Fraction of a nanosecond, in 1/bitRate
+	uint64_t depth; // Nanoseconds of tokens an idle bucket saves up
+};
+uint64_t bitRate; // Bits per second on the wire, 0 = pace by packets
+
 int servPort;
 #ifdef WIN32
 WSADATA wsaData;
@@ -68,16 +126,39 @@ uint16_t altitude; // Map 0..(2^16-1) to -900..19000 meters.
 uint32_t checksum;
 int32_t latitude; // map -(2^31-1)..(2^31-1) to +/- 90, Error Indicator: -(2^31) From MISB 601.2
 int32_t longitude; //Map -(2^31-1)..(2^31-1) to +/-180. Error Indicator: -(2^31)
+double latitudeDegrees; // Sensor position before mapping, for derived fields
+double longitudeDegrees;
+double altitudeMeters;
 uint64_t timestamp;
 
 const unsigned char ldsVersion = 0x02; 	//ldsVersion and uasLdsKey from MISB 601.2 spec
 const unsigned char uasLdsKey[] = {0x06, 0x0E, 0x2B, 0x34, 0x02, 0x0B, 0x01, 0x01,
 															0x0E, 0x01, 0x03, 0x01, 0x01, 0x00, 0x00, 0x00};
-const int PACKET_LENGTH = 78;
 const char ttl = 64;
 
-unsigned char msgLength = 0x3D;
-unsigned char packetBuffer[79];
+#define PACKET_MAX 65507 // Largest UDP payload
+#define PACKET_BATCH_MAX 64
+
+// Send paths for batches, chosen with -U or by calibrate.c
+#define TRANSPORT_SENDMMSG 0
+#define TRANSPORT_SENDTO 1
+#define TRANSPORT_GSO 2 // UDP generic segmentation offload, Linux only
+#define UDP_GSO_BYTES 65000 // Payload bytes per GSO send, under the 64 KB datagram limit
+int sendTransport = TRANSPORT_SENDMMSG;
+int sendBatch = PACKET_BATCH_MAX; // Packets per batch when sending as fast as possible
+
+// Packet layout, set by initPacketLayout() from the fields that are enabled
+int packetLength = 78;
+size_t msgLength = 0x3D;
+int timestampOffset = 19; // Position of the timestamp value
+int motionOffset = 55; // Position of the tag 13 latitude item, start of the orbit fields
+int securityOffset = 71; // Position of the tag 48 security set, when present
+int vmtiOffset = 71; // Position of the tag 74 VMTI set, when present
+unsigned char packetBuffer[PACKET_MAX];
+unsigned char packetTemplate[PACKET_MAX]; // Static fields for the batch builder, zero timestamp
+uint16_t templateChecksum; // Checksum of packetTemplate
+unsigned char *packetPool; // PACKET_BATCH_MAX buffers of packetLength bytes for batches
+unsigned char *packetPoolSlots[PACKET_BATCH_MAX];
 // Entries in the form {Tag, Length}, Tag is specified in MISB 601.2, Length is BER short form
 unsigned char timestampTagLen[] = {0x02, 0x08};
 unsigned char missionTagLen[] = {0x03, 0x0C};
@@ -88,6 +169,74 @@ unsigned char altitudeTagLen[] = {0x0F, 0x02};
 unsigned char versionTagLen[] = {0x41, 0x01};
 unsigned char checksumTagLen[] = {0x01, 0x02};
 
+// Security Local Set (MISB ST 0102), nested in tag 48 when a classification is set.
+// It is encoded once by encodeSecuritySet(); packets copy the cached bytes and
+// add its precomputed share of the checksum.
+#define SECURITY_STRING_MAX 63
+#define SECURITY_SET_MAX 512
+const unsigned char securityTag = 0x30;
+const unsigned char securityCodingMethod = 0x02; // ISO-3166 Three Letter
+const uint16_t securityVersion = 12; // ST 0102.12
+unsigned char securityClassification; // 0 = no security set, 1 = UNCLASSIFIED .. 5 = TOP SECRET
+char securityCountry[SECURITY_STRING_MAX + 1] = "//USA";
+char securityCaveats[SECURITY_STRING_MAX + 1];
+char securityReleasing[SECURITY_STRING_MAX + 1];
+unsigned char securitySet[SECURITY_SET_MAX]; // Tag 48, BER length and value
+int securitySetLength;
+uint32_t securitySetSum; // Checksum contribution of securitySet at securityOffset
+
+// VMTI set (MISB ST 0903) nested in tag 74, defined in vmti.c
+extern unsigned char vmtiSet[];
+extern int vmtiSetLength;
+extern uint32_t vmtiTemplateSum;
+void encodeVmtiSet(void);
+void updateVmtiSet(unsigned char *buff, uint64_t time);
+
+// Orbit position and attitude tags, defined in motion.c
+extern unsigned char attitudeSet[];
+extern int attitudeSetLength;
+extern int motionLength;
+extern uint32_t motionTemplateSum;
+void encodeAttitudeSet(void);
+void updateMotionFields(unsigned char *buff, uint64_t time);
+
+// Footprint tags, defined in geometry.c
+extern unsigned char footprintSet[];
+extern int footprintSetLength;
+void encodeFootprintSet(void);
+void updateFootprintSet(double lat, double lon, double heading);
+
+// Field expressions, defined in expr.c
+extern int exprFieldCount;
+void exprApplyBatch(unsigned char **slots, const uint64_t *times, const int *streams, uint16_t *sums, int count);
+
+// Scripted platform behaviors, defined in behavior.c
+extern int behaviorPlatforms;
+void behaviorApplyBatch(unsigned char **slots, const uint64_t *times, const int *streams, uint16_t *sums, int count);
+
+// Per-stream platform clocks, defined in clock.c
+uint64_t clockModelTime(int stream, uint64_t now);
+
+#ifndef WIN32
+// Capture time index, defined in index.c
+struct klvPacket;
+extern char indexFrom[];
+extern char indexUntil[];
+int klvIndexReplayRange(void);
+int klvIndexRangeNext(struct klvPacket *pkt, uint64_t *time);
+#endif
+
+#ifdef __gnu_linux__
+// Transmit timestamps, defined in txstamp.c
+extern char txstampMode[];
+extern int txstampActive;
+extern uint64_t txstampScheduled;
+int txstampInit(void);
+void txstampSent(unsigned char **packets, const int *lengths, int count);
+void txstampCollect(void);
+void txstampReport(void);
+#endif
+
 struct sockaddr_in servaddr;
 
 //============================================================================
@@ -149,6 +298,9 @@ int udpInit(void) {
 	servaddr.sin_family = AF_INET;
 	servaddr.sin_addr.s_addr = inet_addr(address);
 	servaddr.sin_port = htons(servPort);
+#ifdef __gnu_linux__
+	if (txstampMode[0] != '\0' && txstampInit() == -1) return -1;
+#endif
 
 	//printf("Current servPort: %d, sin_port: %d\n", servPort, servaddr.sin_port);
 	return 0;
@@ -157,20 +309,152 @@ int udpInit(void) {
 //--------------------------------------------------
 // Sends the contents of the given packet, currently fixed length
 int udpSendPacket(const char * packet) {
-	if (sendto(sock, packet, PACKET_LENGTH, 0, (struct sockaddr *)&servaddr, sizeof(servaddr)) == -1) {
+	if (sendto(sock, packet, packetLength, 0, (struct sockaddr *)&servaddr, sizeof(servaddr)) == -1) {
 		perror("Error sending socket message");
 		return -1;
 	}
+#ifdef __gnu_linux__
+	if (txstampActive) txstampSent((unsigned char **)&packet, NULL, 1);
+#endif
 	return 1;
 }
 
 //--------------------------------------------------
-// Checksum algorithm from MISB 601.2, pg. 12
+// Sends count packets with a sendto call each, see udpSendBatchTo()
+int udpSendEach(unsigned char **packets, const int *lengths, const struct sockaddr_in *dests, int count) {
+	int i;
+	for (i = 0; i < count; ++i) {
+		if (sendto(sock, (const char *)packets[i], lengths != NULL ? lengths[i] : packetLength, 0,
+				(struct sockaddr *)(dests != NULL ? &dests[i] : &servaddr), sizeof(servaddr)) == -1) {
+			perror("Error sending socket message");
+			return -1;
+		}
+#ifdef __gnu_linux__
+		// Recorded as the kernel numbers them, a later failure doesn't lose them
+		if (txstampActive) txstampSent(&packets[i], lengths != NULL ? &lengths[i] : NULL, 1);
+#endif
+	}
+	return count;
+}
+
+#ifdef __gnu_linux__
+//--------------------------------------------------
+// Sends count packetLength packets to servaddr with UDP GSO, as few large
+// sends as UDP_GSO_BYTES allows that the kernel splits into the datagrams
+int udpSendSegments(unsigned char **packets, int count) {
+	char control[CMSG_SPACE(sizeof(uint16_t))];
+	struct iovec iovs[PACKET_BATCH_MAX];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	uint16_t segment = packetLength;
+	int i, n, first, perSend = UDP_GSO_BYTES / packetLength;
+
+	if (perSend < 1) perSend = 1;
+	for (first = 0; first < count; first += n) {
+		n = count - first < perSend ? count - first : perSend;
+		for (i = 0; i < n; ++i) {
+			iovs[i].iov_base = packets[first + i];
+			iovs[i].iov_len = packetLength;
+		}
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &servaddr;
+		msg.msg_namelen = sizeof(servaddr);
+		msg.msg_iov = iovs;
+		msg.msg_iovlen = n;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(segment));
+		memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+		if (sendmsg(sock, &msg, 0) == -1) {
+			perror("Error sending segmented message");
+			return -1;
+		}
+		// The kernel numbers and stamps a segmented send once, as its first datagram
+		if (txstampActive) txstampSent(&packets[first], NULL, 1);
+	}
+	return count;
+}
+#endif
+
+//--------------------------------------------------
+// Sends count packets with the selected transport, by default a single
+// sendmmsg call where available. lengths gives each packet's length, or NULL
+// if they are all packetLength, and dests each packet's destination, or NULL
+// to send them all to servaddr. GSO only takes packets of one length to
+// servaddr, others go through sendmmsg.
+int udpSendBatchTo(unsigned char **packets, const int *lengths, const struct sockaddr_in *dests, int count) {
+#ifdef __gnu_linux__
+	struct mmsghdr msgs[PACKET_BATCH_MAX];
+	struct iovec iovs[PACKET_BATCH_MAX];
+	int i, ret, sent = 0;
+
+	if (sendTransport == TRANSPORT_SENDTO) return udpSendEach(packets, lengths, dests, count);
+	if (sendTransport == TRANSPORT_GSO && lengths == NULL && dests == NULL) return udpSendSegments(packets, count);
+	memset(msgs, 0, sizeof(msgs[0]) * count);
+	for (i = 0; i < count; ++i) {
+		iovs[i].iov_base = packets[i];
+		iovs[i].iov_len = lengths != NULL ? lengths[i] : packetLength;
+		msgs[i].msg_hdr.msg_name = dests != NULL ? (void *)&dests[i] : (void *)&servaddr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(servaddr);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	while (sent < count) {
+		ret = sendmmsg(sock, &msgs[sent], count - sent, 0);
+		if (ret == -1) {
+			perror("Error sending socket messages");
+			return -1;
+		}
+		if (txstampActive) txstampSent(&packets[sent], lengths != NULL ? &lengths[sent] : NULL, ret);
+		sent += ret;
+	}
+	return sent;
+#else
+	return udpSendEach(packets, lengths, dests, count);
+#endif
+}
+
+//--------------------------------------------------
+// Sends count packets to servaddr, see udpSendBatchTo()
+int udpSendBatch(unsigned char **packets, const int *lengths, int count) {
+	return udpSendBatchTo(packets, lengths, NULL, count);
+}
+
+//--------------------------------------------------
+// Sums bytes as 16-bit big-endian words, offset is the position of buff[0]
+// within the checksummed region. Lets a checksum be built from pieces.
+// Even and odd bytes are summed separately, 16 at a time with SSE2.
+uint32_t sumBytesAt(const unsigned char *buff, unsigned int len, unsigned int offset) {
+	uint32_t evenSum = 0, oddSum = 0, i = 0;
+#ifdef __SSE2__
+	const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i evenAcc = zero, oddAcc = zero;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&buff[i]);
+		evenAcc = _mm_add_epi64(evenAcc, _mm_sad_epu8(_mm_and_si128(v, lowBytes), zero));
+		oddAcc = _mm_add_epi64(oddAcc, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+	}
+	evenSum = _mm_cvtsi128_si32(evenAcc) + _mm_cvtsi128_si32(_mm_srli_si128(evenAcc, 8));
+	oddSum = _mm_cvtsi128_si32(oddAcc) + _mm_cvtsi128_si32(_mm_srli_si128(oddAcc, 8));
+#endif
+	for (; i + 1 < len; i += 2) {
+		evenSum += buff[i];
+		oddSum += buff[i + 1];
+	}
+	if (i < len) evenSum += buff[i];
+	if (offset % 2) return (oddSum << 8) + evenSum;
+	return (evenSum << 8) + oddSum;
+}
+
+//--------------------------------------------------
+// Checksum algorithm from MISB 601.2, pg. 12:
+// bcc += buff[i] << (8 * ((i + 1) % 2)) over the packet up to the checksum value
 uint16_t makeChecksum(unsigned char *buff, unsigned short len) {
-	uint16_t bcc = 0, i;
-	for ( i = 0 ; i < len; i++) 
-    bcc += buff[i] << (8 * ((i + 1) % 2)); 
-  return bcc;
+	return (uint16_t)sumBytesAt(buff, len, 0);
 }
 
 //--------------------------------------------------
@@ -185,44 +469,296 @@ int sysIsBigEndian(void) {
 }
 
 //--------------------------------------------------
-// Convert ints of type uint64_t to network order, checks if conversion is needed.
+// Convert ints of type uint64_t to network order. The byte order is known at
+// compile time on GCC and Clang, other compilers fall back to a runtime check.
 uint64_t htonll(uint64_t num) {
+#if (defined KLV_BIG_ENDIAN) && KLV_BIG_ENDIAN
+	return num;
+#elif (defined KLV_BIG_ENDIAN) && (defined __GNUC__)
+	return __builtin_bswap64(num);
+#else
 	if (sysIsBigEndian()) return num;
 	else return (((num & 0xFFULL) << 56) | ((num & 0xFF00000000000000ULL) >> 56) |
 								((num & 0xFF00ULL) << 40) | ((num & 0x00FF000000000000ULL) >> 40) |
 								((num & 0xFF0000ULL) << 24) | ((num & 0x0000FF0000000000ULL) >> 24) |
 								((num & 0xFF000000ULL) << 8) | ((num & 0x000000FF00000000ULL) >> 8));
+#endif
+}
+
+#ifdef KLV_HAVE_SSSE3
+//--------------------------------------------------
+// pshufb kernels for the array conversions below, two timestamps or four
+// coordinates per 128-bit shuffle
+__attribute__((target("ssse3")))
+void htonllArraySsse3(uint64_t *dst, const uint64_t *src, int count) {
+	const __m128i mask = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	int i;
+	for (i = 0; i + 2 <= count; i += 2)
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&src[i]), mask));
+	for (; i < count; ++i) dst[i] = htonll(src[i]);
+}
+
+__attribute__((target("ssse3")))
+void htonlArraySsse3(uint32_t *dst, const uint32_t *src, int count) {
+	const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	int i;
+	for (i = 0; i + 4 <= count; i += 4)
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&src[i]), mask));
+	for (; i < count; ++i) dst[i] = htonl(src[i]);
+}
+#endif
+
+//--------------------------------------------------
+// Convert an array of uint64_t (timestamps) to network order, dst may equal src
+void htonllArray(uint64_t *dst, const uint64_t *src, int count) {
+	int i;
+#if (defined KLV_BIG_ENDIAN) && !KLV_BIG_ENDIAN && (defined KLV_HAVE_SSSE3)
+	if (__builtin_cpu_supports("ssse3")) {
+		htonllArraySsse3(dst, src, count);
+		return;
+	}
+#endif
+	for (i = 0; i < count; ++i) dst[i] = htonll(src[i]);
+}
+
+//--------------------------------------------------
+// Convert an array of uint32_t (mapped coordinates) to network order, dst may equal src
+void htonlArray(uint32_t *dst, const uint32_t *src, int count) {
+	int i;
+#if (defined KLV_BIG_ENDIAN) && !KLV_BIG_ENDIAN && (defined KLV_HAVE_SSSE3)
+	if (__builtin_cpu_supports("ssse3")) {
+		htonlArraySsse3(dst, src, count);
+		return;
+	}
+#endif
+	for (i = 0; i < count; ++i) dst[i] = htonl(src[i]);
+}
+
+//--------------------------------------------------
+// Writes len as a BER length (short form below 128, long form otherwise),
+// returns the number of bytes written
+int berEncodeLength(unsigned char *buff, size_t len) {
+	int bytes = 0, i;
+	size_t rest;
+	if (len < 128) {
+		buff[0] = (unsigned char)len;
+		return 1;
+	}
+	for (rest = len; rest > 0; rest >>= 8) bytes++;
+	buff[0] = 0x80 | bytes;
+	for (i = bytes; i > 0; --i, len >>= 8) buff[i] = len & 0xFF;
+	return bytes + 1;
+}
+
+//--------------------------------------------------
+// Copies len bytes to buff at pos, returns the position after them
+int appendBytes(unsigned char *buff, int pos, const void *src, size_t len) {
+	memcpy(&buff[pos], src, len);
+	return pos + len;
+}
+
+//--------------------------------------------------
+// Appends a tag, BER length and value, returns the position after them
+int appendItem(unsigned char *buff, int pos, unsigned char tag, const void *value, size_t len) {
+	buff[pos++] = tag;
+	pos += berEncodeLength(&buff[pos], len);
+	return appendBytes(buff, pos, value, len);
+}
+
+//--------------------------------------------------
+// Parses a classification given by name or as 1..5, returns 0 if unknown
+unsigned char parseClassification(const char *str) {
+	const char *names[] = {"UNCLASSIFIED", "RESTRICTED", "CONFIDENTIAL", "SECRET", "TOP SECRET"};
+	int i;
+	for (i = 0; i < 5; ++i) {
+		if (strcmp(str, names[i]) == 0) return i + 1;
+	}
+	i = atoi(str);
+	return (i >= 1 && i <= 5) ? i : 0;
+}
+
+//--------------------------------------------------
+// Encode the ST 0102 Security Local Set into securitySet. Only needs to run
+// again if the security options change.
+void encodeSecuritySet(void) {
+	unsigned char value[SECURITY_SET_MAX];
+	unsigned char objectCountry[2 * SECURITY_STRING_MAX]; // UTF-16 per ST 0102.12
+	uint16_t netVersion = htons(securityVersion);
+	const char *country = securityCountry;
+	int len = 0, objectLength = 0, pos;
+
+	securitySetLength = 0;
+	if (securityClassification == 0) return;
+	len = appendItem(value, len, 0x01, &securityClassification, 1);
+	len = appendItem(value, len, 0x02, &securityCodingMethod, 1);
+	len = appendItem(value, len, 0x03, securityCountry, strlen(securityCountry));
+	if (securityCaveats[0] != '\0') len = appendItem(value, len, 0x05, securityCaveats, strlen(securityCaveats));
+	if (securityReleasing[0] != '\0') len = appendItem(value, len, 0x06, securityReleasing, strlen(securityReleasing));
+	// The object country defaults to the classifying country without its "//" prefix
+	while (*country == '/') country++;
+	for (; *country != '\0'; country++) {
+		objectCountry[objectLength++] = 0;
+		objectCountry[objectLength++] = *country;
+	}
+	len = appendItem(value, len, 0x0C, &securityCodingMethod, 1);
+	len = appendItem(value, len, 0x0D, objectCountry, objectLength);
+	len = appendItem(value, len, 0x16, &netVersion, 2);
+
+	pos = appendItem(securitySet, 0, securityTag, value, len);
+	securitySetLength = pos;
+}
+
+//--------------------------------------------------
+// Compute the message length and field offsets for the enabled fields, and
+// the security set's share of the checksum at its offset in the packet
+void initPacketLayout(void) {
+	unsigned char ber[9];
+	int valueLength = 10 + 14 + 14 + 6 + 6 + 4 + attitudeSetLength + footprintSetLength + securitySetLength + vmtiSetLength + 3 + 4;
+
+	msgLength = valueLength;
+	timestampOffset = 16 + berEncodeLength(ber, msgLength) + 2;
+	motionOffset = timestampOffset + 8 + 14 + 14;
+	securityOffset = motionOffset + 6 + 6 + 4 + attitudeSetLength + footprintSetLength;
+	// The orbit rewrites position, attitude and footprint per packet
+	motionLength = attitudeSetLength > 0 ? securityOffset - motionOffset : 0;
+	vmtiOffset = securityOffset + securitySetLength;
+	packetLength = timestampOffset - 2 + valueLength;
+	securitySetSum = sumBytesAt(securitySet, securitySetLength, securityOffset);
+	vmtiTemplateSum = sumBytesAt(vmtiSet, vmtiSetLength, vmtiOffset);
+}
+
+//--------------------------------------------------
+// Copy all fields into the packet buffer, nested sets as encoded, and return
+// the position of the checksum value
+int writePacketFields(unsigned char *buff) {
+	int pos;
+	pos = appendBytes(buff, 0, uasLdsKey, 16);
+	pos += berEncodeLength(&buff[pos], msgLength);
+	pos = appendBytes(buff, pos, timestampTagLen, 2);
+	pos = appendBytes(buff, pos, &timestamp, 8);
+	pos = appendBytes(buff, pos, missionTagLen, 2);
+	pos = appendBytes(buff, pos, missionId, 12);
+	pos = appendBytes(buff, pos, platformTagLen, 2);
+	pos = appendBytes(buff, pos, platform, 12);
+	pos = appendBytes(buff, pos, latitudeTagLen, 2);
+	pos = appendBytes(buff, pos, &latitude, 4);
+	pos = appendBytes(buff, pos, longitudeTagLen, 2);
+	pos = appendBytes(buff, pos, &longitude, 4);
+	pos = appendBytes(buff, pos, altitudeTagLen, 2);
+	pos = appendBytes(buff, pos, &altitude, 2);
+	pos = appendBytes(buff, pos, attitudeSet, attitudeSetLength);
+	pos = appendBytes(buff, pos, footprintSet, footprintSetLength);
+	pos = appendBytes(buff, pos, securitySet, securitySetLength);
+	pos = appendBytes(buff, pos, vmtiSet, vmtiSetLength);
+	pos = appendBytes(buff, pos, versionTagLen, 2);
+	pos = appendBytes(buff, pos, &ldsVersion, 1);
+	return appendBytes(buff, pos, checksumTagLen, 2);
+}
+
+//--------------------------------------------------
+// Checksum of a packet up to pos, with the security set's precomputed share
+uint16_t packetChecksum(unsigned char *buff, int pos) {
+	int after = securityOffset + securitySetLength;
+	return (uint16_t)(makeChecksum(buff, securityOffset) + securitySetSum +
+			sumBytesAt(&buff[after], pos - after, after));
 }
 
 //--------------------------------------------------
 // Assemble packet in the given buffer
 // Will write all fields, to make later modifications easier
-// If we need more efficiency, static fields can be initialized on startup, then change only the timestamp.
+// initPacketTemplate() builds the static fields once for makePacketBatch().
 void makePacket(unsigned char *buff) {
-	// Copy all fields into the packet buffer
-	memcpy(&buff[0], &uasLdsKey, 16);
-	memcpy(&buff[16], &msgLength, 1);
-	memcpy(&buff[17], &timestampTagLen, 2);
-	memcpy(&buff[19], &timestamp, 8);
-	memcpy(&buff[27], &missionTagLen, 2);
-	memcpy(&buff[29], &missionId, 12);
-	memcpy(&buff[41], &platformTagLen, 2);
-	memcpy(&buff[43], &platform, 12);
-	memcpy(&buff[55], &latitudeTagLen, 2);
-	memcpy(&buff[57], &latitude, 4);
-	memcpy(&buff[61], &longitudeTagLen, 2);
-	memcpy(&buff[63], &longitude, 4);
-	memcpy(&buff[67], &altitudeTagLen, 2);
-	memcpy(&buff[69], &altitude, 2);
-	memcpy(&buff[71], &versionTagLen, 2);
-	memcpy(&buff[73], &ldsVersion, 1);
-	memcpy(&buff[74], &checksumTagLen, 2);
-	//calculate checksum on buffer
-	checksum = makeChecksum(buff, 76);
-	memcpy(&buff[76], &checksum, 2);
+	uint16_t netChecksum;
+	int pos = writePacketFields(buff);
+	if (motionLength > 0) updateMotionFields(&buff[motionOffset], htonll(timestamp));
+	if (vmtiSetLength > 0) updateVmtiSet(&buff[vmtiOffset], htonll(timestamp));
+	if (exprFieldCount > 0 || behaviorPlatforms > 0) {
+		uint64_t time = htonll(timestamp);
+		if (exprFieldCount > 0) exprApplyBatch(&buff, &time, NULL, NULL, 1);
+		if (behaviorPlatforms > 0) behaviorApplyBatch(&buff, &time, NULL, NULL, 1);
+	}
+	//calculate checksum on buffer, sent big-endian like every other field
+	checksum = packetChecksum(buff, pos);
+	netChecksum = htons((uint16_t)checksum);
+	memcpy(&buff[pos], &netChecksum, 2);
 	return;
 }
 
+//--------------------------------------------------
+// Build the packet template used by makePacketBatch, call after the static
+// fields (mission ID, platform, position, security) are set
+void initPacketTemplate(void) {
+	uint64_t savedTimestamp = timestamp;
+	int i;
+	encodeAttitudeSet();
+	encodeFootprintSet();
+	encodeSecuritySet();
+	encodeVmtiSet();
+	initPacketLayout();
+	timestamp = 0;
+	templateChecksum = packetChecksum(packetTemplate, writePacketFields(packetTemplate));
+	motionTemplateSum = sumBytesAt(&packetTemplate[motionOffset], motionLength, motionOffset);
+	timestamp = savedTimestamp;
+
+	free(packetPool);
+	packetPool = malloc((size_t)PACKET_BATCH_MAX * packetLength);
+	if (packetPool == NULL) {
+		printf("ERROR: Unable to allocate packet buffers\n");
+		exit(-1);
+	}
+	for (i = 0; i < PACKET_BATCH_MAX; ++i) packetPoolSlots[i] = &packetPool[i * packetLength];
+}
+
+//--------------------------------------------------
+// Assemble count packets, one per slot, stamped with the matching entry of
+// times (host order, microseconds). The times can be a run of consecutive
+// scheduled ticks or the same tick for many streams, streams gives each
+// packet's stream index for field expressions (NULL = all stream 0).
+// The byte swaps and checksum deltas run as separate loops over plain arrays
+// so the compiler can vectorize them across packets; only the copies into
+// the slots are done one packet at a time.
+void makePacketBatch(unsigned char **slots, const uint64_t *times, const int *streams, int count) {
+	uint64_t netTimes[PACKET_BATCH_MAX];
+	uint16_t sums[PACKET_BATCH_MAX];
+	uint16_t netSum;
+	int swapWords = timestampOffset % 2;
+	int i;
+
+	htonllArray(netTimes, times, count);
+	// At an odd offset (short form message length) each 16-bit word of the
+	// timestamp adds to the checksum byte-swapped. Templates have a zero timestamp.
+	for (i = 0; i < count; ++i) {
+		uint64_t s = times[i];
+		if (swapWords) s = ((s & 0x00FF00FF00FF00FFULL) << 8) | ((s >> 8) & 0x00FF00FF00FF00FFULL);
+		s = (s & 0x0000FFFF0000FFFFULL) + ((s >> 16) & 0x0000FFFF0000FFFFULL);
+		sums[i] = (uint16_t)(templateChecksum + s + (s >> 32));
+	}
+	for (i = 0; i < count; ++i) {
+		memcpy(slots[i], packetTemplate, packetLength);
+		memcpy(&slots[i][timestampOffset], &netTimes[i], 8);
+	}
+	// Orbit position and VMTI targets move every packet, their share of the
+	// checksum is summed again
+	if (motionLength > 0) {
+		for (i = 0; i < count; ++i) {
+			updateMotionFields(&slots[i][motionOffset], times[i]);
+			sums[i] += sumBytesAt(&slots[i][motionOffset], motionLength, motionOffset) - motionTemplateSum;
+		}
+	}
+	if (vmtiSetLength > 0) {
+		for (i = 0; i < count; ++i) {
+			updateVmtiSet(&slots[i][vmtiOffset], times[i]);
+			sums[i] += sumBytesAt(&slots[i][vmtiOffset], vmtiSetLength, vmtiOffset) - vmtiTemplateSum;
+		}
+	}
+	if (exprFieldCount > 0) exprApplyBatch(slots, times, streams, sums, count);
+	if (behaviorPlatforms > 0) behaviorApplyBatch(slots, times, streams, sums, count);
+	for (i = 0; i < count; ++i) {
+		netSum = htons(sums[i]);
+		memcpy(&slots[i][packetLength - 2], &netSum, 2);
+	}
+}
+
 //--------------------------------------------------
 // Returns the current UNIX timestamp in microseconds
 uint64_t updateTimestamp(void) {
@@ -267,21 +803,274 @@ uint64_t updateTimestamp(void) {
 #endif
 }
 //--------------------------------------------------
+// Nanoseconds on the monotonic clock, used for pacing
+uint64_t monotonicNanoseconds(void) {
+#ifdef WIN32
+	LARGE_INTEGER frequency, count;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&count);
+	return (uint64_t)(count.QuadPart / frequency.QuadPart) * 1000000000 +
+			(uint64_t)(count.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+//--------------------------------------------------
+// Sleeps until the given monotonic time in nanoseconds
+void sleepUntil(uint64_t deadline) {
+#ifdef __gnu_linux__
+	struct timespec ts;
+	ts.tv_sec = deadline / 1000000000;
+	ts.tv_nsec = deadline % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#else
+	uint64_t now = monotonicNanoseconds();
+	if (deadline <= now) return;
+#	ifdef WIN32
+	Sleep((DWORD)((deadline - now) / 1000000));
+#	else
+	struct timespec ts;
+	ts.tv_sec = (deadline - now) / 1000000000;
+	ts.tv_nsec = (deadline - now) % 1000000000;
+	nanosleep(&ts, NULL);
+#	endif
+#endif
+}
+
+//--------------------------------------------------
+// Monotonic time in nanoseconds of the first packet of a stream sending every
+// period nanoseconds: the next wall clock multiple of startBoundary, plus the
+// stream's phase. Instances sharing a boundary and rate tick together with
+// equal phase slots, and evenly spread across the period with distinct ones.
+uint64_t streamStartTime(uint64_t period) {
+	uint64_t start = monotonicNanoseconds();
+	uint64_t boundary, wallNow;
+	if (startBoundary > 0) {
+		boundary = (uint64_t)startBoundary * 1000000000;
+		wallNow = updateTimestamp() * 1000;
+		start += boundary - wallNow % boundary;
+	}
+	return start + period * phaseSlot / phaseSlots;
+}
+
+//--------------------------------------------------
+// Parses a rate given as a fraction (30000/1001) or a decimal (29.97),
+// returns -1 if it is malformed
+int parseRateValue(const char *str, uint64_t *numerator, uint64_t *denominator) {
+	uint64_t num = 0, den = 1;
+	const char *p = str;
+
+	if (*p < '0' || *p > '9') return -1;
+	for (; *p >= '0' && *p <= '9'; ++p) {
+		num = num * 10 + (*p - '0');
+		if (num > 1000000000000ULL) return -1;
+	}
+	if (*p == '.') {
+		for (++p; *p >= '0' && *p <= '9'; ++p) {
+			if (den == 1000000000 || num > 1000000000000ULL) return -1;
+			num = num * 10 + (*p - '0');
+			den *= 10;
+		}
+	}
+	else if (*p == '/') {
+		if (p[1] < '0' || p[1] > '9') return -1;
+		for (den = 0, ++p; *p >= '0' && *p <= '9'; ++p) {
+			den = den * 10 + (*p - '0');
+			if (den > 1000000000) return -1;
+		}
+		if (den == 0) return -1;
+	}
+	if (*p != '\0') return -1;
+	*numerator = num;
+	*denominator = den;
+	return 0;
+}
+
+//--------------------------------------------------
+// Parses the rate into rateNumerator and rateDenominator, see parseRateValue()
+int parseRate(const char *str) {
+	if (parseRateValue(str, &rateNumerator, &rateDenominator) == -1) return -1;
+	sendRate = (float)((double)rateNumerator / rateDenominator);
+	return 0;
+}
+
+//--------------------------------------------------
+// Starts a pacer for numerator/denominator packets per second, with its first
+// deadline at start (monotonic nanoseconds)
+void ratePacerStart(struct ratePacer *pacer, uint64_t numerator, uint64_t denominator, uint64_t start) {
+	uint64_t interval = denominator * 1000000000;
+	pacer->numerator = numerator;
+	pacer->denominator = denominator;
+	pacer->period = interval / numerator;
+	pacer->remainder = interval % numerator;
+	pacer->carry = 0;
+	pacer->deadline = start;
+}
+
+//--------------------------------------------------
+// Starts a pacer at the configured rate and the stream's first deadline, see
+// streamStartTime()
+void ratePacerInit(struct ratePacer *pacer) {
+	ratePacerStart(pacer, rateNumerator, rateDenominator, 0);
+	pacer->deadline = streamStartTime(pacer->period);
+}
+
+//--------------------------------------------------
+// Advances to the next deadline, carrying the remainder so no error accumulates
+void ratePacerNext(struct ratePacer *pacer) {
+	pacer->deadline += pacer->period;
+	pacer->carry += pacer->remainder;
+	if (pacer->carry >= pacer->numerator) {
+		pacer->carry -= pacer->numerator;
+		pacer->deadline++;
+	}
+}
+
+//--------------------------------------------------
+// Bytes a UDP payload takes on the wire, with the headers, framing and gap of
+// every IP fragment
+uint64_t wireBytes(int payload) {
+	int ip = payload + WIRE_UDP_HEADER, fragments = (ip + WIRE_FRAGMENT - 1) / WIRE_FRAGMENT;
+	if (ip + WIRE_IP_HEADER < WIRE_FRAME_MIN) return WIRE_FRAME_MIN + WIRE_FRAME_OVERHEAD;
+	return ip + (uint64_t)fragments * (WIRE_IP_HEADER + WIRE_FRAME_OVERHEAD);
+}
+
+//--------------------------------------------------
+// Packets of a size to send per batch at bitRate, about BITRATE_BURST of
+// traffic and at most sendBatch
+int bitRateBatch(int payload) {
+	uint64_t n = bitRate * BITRATE_BURST / 1000000000 / 8 / wireBytes(payload);
+	return n < 1 ? 1 : n > (uint64_t)sendBatch ? sendBatch : (int)n;
+}
+
+//--------------------------------------------------
+// Starts a bucket at start, able to save up depth bytes while idle
+void byteBucketStart(struct byteBucket *bucket, uint64_t start, uint64_t depth) {
+	bucket->deadline = start;
+	bucket->carry = 0;
+	bucket->depth = depth * 8 * 1000000000 / bitRate;
+}
+
+//--------------------------------------------------
+// Waits until the bucket has tokens, then takes bytes from it, going into
+// debt for a batch larger than what is left. Returns the time the bytes were
+// due, monotonic nanoseconds.
+uint64_t byteBucketTake(struct byteBucket *bucket, uint64_t bytes) {
+	uint64_t now = monotonicNanoseconds(), due, bits = bytes * 8;
+
+	if (bucket->deadline + bucket->depth < now) {
+		bucket->deadline = now - bucket->depth;
+		bucket->carry = 0;
+	}
+	if (bucket->deadline > now) sleepUntil(bucket->deadline);
+	due = bucket->deadline;
+	bucket->deadline += bits * 1000000000 / bitRate;
+	bucket->carry += bits * 1000000000 % bitRate;
+	if (bucket->carry >= bitRate) {
+		bucket->carry -= bitRate;
+		bucket->deadline++;
+	}
+	return due;
+}
+
+//--------------------------------------------------
+// Sends batches of packets at bitRate on the wire, returns on error
+void udpSendBitRate(void) {
+	struct byteBucket bucket;
+	uint64_t times[PACKET_BATCH_MAX];
+	uint64_t now;
+	int i, n = bitRateBatch(packetLength);
+
+	byteBucketStart(&bucket, streamStartTime(0), n * wireBytes(packetLength));
+	while (1) {
+#ifdef __gnu_linux__
+		txstampScheduled = byteBucketTake(&bucket, n * wireBytes(packetLength));
+#else
+		byteBucketTake(&bucket, n * wireBytes(packetLength));
+#endif
+		now = clockModelTime(0, updateTimestamp());
+		for (i = 0; i < n; ++i) times[i] = now;
+		makePacketBatch(packetPoolSlots, times, NULL, n);
+		if (udpSendBatch(packetPoolSlots, NULL, n) == -1) return;
+	}
+}
+
+//--------------------------------------------------
+// Sends batches of packets as fast as the socket accepts them, returns on error
+void udpFlood(void) {
+	uint64_t times[PACKET_BATCH_MAX];
+	uint64_t now;
+	int i;
+
+	while (1) {
+		now = clockModelTime(0, updateTimestamp());
+		for (i = 0; i < sendBatch; ++i) times[i] = now;
+		makePacketBatch(packetPoolSlots, times, NULL, sendBatch);
+		if (udpSendBatch(packetPoolSlots, NULL, sendBatch) == -1) return;
+	}
+}
+//--------------------------------------------------
 // Displays help information for the tool
 void help(void) {
 	printf("Usage: klvgen -a <address> -p <port> -r <rate> ...\n");
 	printf("  -a or --address <address>\n\tDestination address in dotted quad notation (e.g. 127.0.0.1)\n\tDefault: 127.0.0.1\n");
 	printf("  -p or --port <port>\n\tThe port to send packets to\n\tDefault: 9000\n");
-	printf("  -r or --rate <rate>\n\tPackets per second (e.g. rate = 30, 30 packets sent per second)\n\tDefault: 1\n");
+	printf("  -r or --rate <rate>\n\tPackets per second (e.g. rate = 30, 30 packets sent per second)\n\tFractions are kept exact, e.g. 30000/1001 for 29.97 fps video\n\tA rate of 0 sends batches as fast as possible\n\tDefault: 1\n");
+	printf("  -B or --bitrate <Mbps>\n\tPace by bits per second on the wire instead of packets, counting the UDP,\n\tIP and Ethernet overhead of every packet and fragment. Replaces -r, and the\n\tcapture timing when replaying\n");
+	printf("  -b or --start-boundary <seconds>\n\tWait for the wall clock to reach a multiple of seconds before the first\n\tpacket, so instances started separately tick together\n\tDefault: start immediately\n");
+	printf("  -P or --phase <slot>/<slots>\n\tSend slot/slots of a period after each tick, e.g. four instances at the\n\tsame rate and boundary with 0/4, 1/4, 2/4 and 3/4 spread evenly\n\tDefault: 0/1, aligned to the tick\n");
 	printf("  -m or --mission-id <mission-id>\n\t\tMission ID, limited to 12 ASCII characters\n\tDefault: Mission 01\n");
 	printf("  -n or --platform <platform>\n\tThe platform name, limited to 12 ASCII characters\n\tDefault: Demo\n");
 	printf("  -t or --latitude <latitude>\n\tSensor latitude, given in degrees (e.g. for 35.7S, enter-35.7\n\tDefault: 44.64423\n");
 	printf("  -g or --longitude <longitude>\n\tSensor longitude, given in degrees (e.g. for 93.2W, enter-93.2\n\tDefault: -93.24013\n");
 	printf("  -e or --altitude <altitude>\n\tSensor altitude, given in meters\n\tDefault: 333\n");
+	printf("  -O or --orbit <radius>\n\tFly a clockwise orbit of radius meters around the given position, adding\n\theading, pitch, roll, ground speed and sensor angle tags\n\tDefault: stationary, no attitude tags\n");
+	printf("  -G or --ground-speed <speed>\n\tOrbit ground speed in meters per second, 1 to 255\n\tDefault: 40\n");
+	printf("  -V or --fov <horizontal>[x<vertical>]\n\tSensor field of view in degrees, adds the frame center and corner tags\n\tfrom the line of sight, straight down without an orbit\n\tDefault: no footprint tags, vertical defaults to 9/16 of horizontal\n");
+	printf("  -D or --dem <directory>\n\tDirectory of SRTM .hgt tiles (e.g. N44W094.hgt) for the footprint terrain\n\tDefault: flat terrain at sea level\n");
+	printf("  -T or --vmti-targets <count>\n\tAdd an ST 0903 VMTI set (tag 74) with count moving targets, 0 to 1400\n\tDefault: no VMTI set\n");
+#ifndef WIN32
+	printf("  -f or --replay <file>\n\tReplay a raw .klv or pcap capture instead of generating packets\n");
+	printf("  -s or --speed <factor>\n\tReplay speed, 1 keeps the captured timing, 10 is ten times faster,\n\t0 sends as fast as possible\n\tDefault: 1\n");
+	printf("  -w or --rewrite-time\n\tRewrite replayed timestamps to the current time, recomputing checksums\n");
+	printf("  -o or --from <time>, -u or --until <time>\n\tReplay only packets from and before the times, UNIX seconds or +seconds from\n\tthe first packet, seeking with the capture's index (built if missing)\n");
+	printf("  -i or --index <seconds>\n\tBuild the time index <file>.kidx of the replay file with an entry per\n\tplatform every seconds, then exit\n\tDefault: 1 second when replay builds it\n");
+	printf("  -F or --frame-source <source>\n\tSend one packet per video frame tick (\"frame pts\", 90 kHz PTS) read from\n\t- (stdin), unix:<path> (datagram socket) or shm:<name> (shared memory doorbell)\n");
+#endif
+#ifndef WIN32
+	printf("  -j or --workers <count>\n\tFork count worker processes and split the streams between them,\n\treporting their combined counters every second\n");
+	printf("  -N or --streams <count>\n\tNumber of streams for the workers, stream k is sent to port + k\n\tDefault: one per worker\n");
+	printf("  -U or --transport <sendto|sendmmsg|gso>[:batch] or auto[:null]\n\tHow batches are sent, and how many packets per batch when flooding (Linux\n\tonly). auto benchmarks each at startup against the destination, or a local\n\tsink with auto:null, and picks the least CPU reaching the target rate\n\tDefault: sendmmsg:64\n");
+	printf("  -K or --clock <model>\n\tGive each stream its own clock for the embedded timestamps, comma\n\tseparated: offset=<ms>, drift=<ppm>, walk=<us after 1 s>, step=<mean s>:<ms>,\n\tseed=<n>. A ~ before a value draws it per stream from +/- the value\n\te.g. offset=~500,drift=~50,walk=20,step=60:~100\n");
+	printf("  -E or --expr <field>=<expression>\n\tDrive lat, lon, alt, mission or platform from a formula over t (seconds),\n\tn (packet number) and k (stream index), e.g. \"alt=1500 + 200 * sin(t / 30)\".\n\tmission and platform write an integer into their run of #. Operators\n\t+ - * / %% ^, functions sin cos tan abs floor sqrt min max rand. Repeat\n\tfor more fields\n");
+	printf("  -A or --behavior <script>\n\tFly each stream's platform through a sortie, comma separated steps\n\ttakeoff=<m>, goto=<lat>:<lon>[:<m>], loiter=<s>:<radius m> (0 s = until\n\trecalled), rtb, and settings speed=<m/s>, climb=<m/s>, stagger=<s per\n\tstream>, spacing=<m east per stream>, repeat. SIGUSR1 recalls them all\n");
+	printf("  -S or --tx-timestamps <sw|hw:interface>\n\tRead kernel (and NIC) transmit timestamps and report the latency from\n\tschedule to KLV timestamp to wire (Linux only)\n");
+	printf("  -d or --daemon <path>\n\tRun as a daemon taking jobs on a Unix socket at path, one command per line:\n\tcreate [key=value ...], update <id> key=value ..., pause <id>, resume <id>,\n\tdestroy <id>, list. Keys: rate, address, port, streams, mission, platform,\n\tlat, lon, alt, heading, speed (m/s)\n");
+#endif
+	printf("  -c or --classification <level>\n\tAdd an ST 0102 security set (tag 48) with the given classification\n\tUNCLASSIFIED, RESTRICTED, CONFIDENTIAL, SECRET, TOP SECRET or 1-5\n\tDefault: no security set\n");
+	printf("  -C or --country <country>\n\tClassifying country, ISO-3166 three letter code\n\tDefault: //USA\n");
+	printf("  -k or --caveats <caveats>\n\tSecurity caveats (e.g. FOUO)\n");
+	printf("  -R or --releasing <countries>\n\tReleasing instructions, space separated country codes (e.g. \"USA GBR\")\n");
+#ifdef __gnu_linux__
+	printf("  -x or --xdp <interface>\n\tSend prebuilt frames through an AF_XDP socket (copy mode) on the interface\n");
+	printf("  -q or --xdp-queue <queue>\n\tInterface queue the XDP socket binds to\n\tDefault: 0\n");
+	printf("  -l or --listen <threads>[:cpu]\n\tReceive and check streams on port (and the -N ports after it) instead of\n\tsending, with threads sharing each port through SO_REUSEPORT, reporting\n\tstreams, losses, reordering and latency. :cpu steers each packet to the\n\tthread on the CPU that received it\n");
+	printf("  -Z or --state <name>[:capacity]\n\tWith -l, keep every platform's latest decoded state in POSIX shared memory\n\t<name>, readable by any number of local readers without locks. Alone,\n\tprint a snapshot of the table\n\tDefault capacity: 16384 platforms\n");
+	printf("  -M or --dst-mac <mac>\n\tDestination MAC address for XDP frames (e.g. 02:00:00:00:00:01)\n\tDefault: ff:ff:ff:ff:ff:ff\n");
+#endif
 }
 //--------------------------------------------------
 // Closes UDP socket before exiting
 void exitProgram() {
+#ifdef __gnu_linux__
+	if (txstampActive) {
+		txstampCollect();
+		txstampReport();
+	}
+#endif
 #ifdef WIN32
 	closesocket(sock);
 	WSACleanup();
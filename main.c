@@ -26,6 +26,26 @@
 //============================================================================
 
 #include "klvgen.c"
+#include "imapb.c"
+#include "vmti.c"
+#include "dem.c"
+#include "motion.c"
+#include "geometry.c"
+#include "decode.c"
+#include "scan.c"
+#include "clock.c"
+#include "expr.c"
+#include "behavior.c"
+#include "txstamp.c"
+#include "replay.c"
+#include "index.c"
+#include "frame.c"
+#include "coord.c"
+#include "daemon.c"
+#include "calibrate.c"
+#include "xdp.c"
+#include "state.c"
+#include "recv.c"
 
 //============================================================================
 int main(int argc, char *argv[]) {
@@ -44,7 +64,10 @@ int main(int argc, char *argv[]) {
 	strcpy(platform, "Demo");
 	latitude = (uint32_t)htonl(mapLatitude("44.64423"));
 	longitude = (uint32_t)htonl(mapLongitude("-93.24013"));
+	latitudeDegrees = 44.64423;
+	longitudeDegrees = -93.24013;
 	altitude = (uint16_t)htons(mapAltitude("333"));
+	altitudeMeters = 333;
 	strcpy(address, "127.0.0.1");
 	servPort = 9000;
 	DEBUG = 0;
@@ -59,16 +82,48 @@ int main(int argc, char *argv[]) {
 		 {"address", 		required_argument, 0, 'a'},
 		 {"port", 	 		required_argument, 0, 'p'},
 		 {"rate",  	 		required_argument, 0, 'r'},
+		 {"bitrate",    required_argument, 0, 'B'},
+		 {"start-boundary", required_argument, 0, 'b'},
+		 {"phase",      required_argument, 0, 'P'},
 		 {"mission-id", required_argument, 0, 'm'},
 		 {"platform",   required_argument, 0, 'n'},
 		 {"latitude",   required_argument, 0, 't'},
 		 {"longitude",  required_argument, 0, 'g'},
 		 {"altitude",   required_argument, 0, 'e'},
+		 {"replay",     required_argument, 0, 'f'},
+		 {"speed",      required_argument, 0, 's'},
+		 {"rewrite-time", no_argument,     0, 'w'},
+		 {"frame-source", required_argument, 0, 'F'},
+		 {"orbit",      required_argument, 0, 'O'},
+		 {"ground-speed", required_argument, 0, 'G'},
+		 {"fov",        required_argument, 0, 'V'},
+		 {"dem",        required_argument, 0, 'D'},
+		 {"workers",    required_argument, 0, 'j'},
+		 {"streams",    required_argument, 0, 'N'},
+		 {"daemon",     required_argument, 0, 'd'},
+		 {"tx-timestamps", required_argument, 0, 'S'},
+		 {"clock",      required_argument, 0, 'K'},
+		 {"expr",       required_argument, 0, 'E'},
+		 {"behavior",   required_argument, 0, 'A'},
+		 {"listen",     required_argument, 0, 'l'},
+		 {"state",      required_argument, 0, 'Z'},
+		 {"index",      required_argument, 0, 'i'},
+		 {"from",       required_argument, 0, 'o'},
+		 {"until",      required_argument, 0, 'u'},
+		 {"transport",  required_argument, 0, 'U'},
+		 {"vmti-targets", required_argument, 0, 'T'},
+		 {"classification", required_argument, 0, 'c'},
+		 {"country",    required_argument, 0, 'C'},
+		 {"caveats",    required_argument, 0, 'k'},
+		 {"releasing",  required_argument, 0, 'R'},
+		 {"xdp",        required_argument, 0, 'x'},
+		 {"xdp-queue",  required_argument, 0, 'q'},
+		 {"dst-mac",    required_argument, 0, 'M'},
 		 {"help", no_argument,       0, 'h'},
 		 {"version", no_argument,       0, 'v'},
 		 {0, 0, 0, 0}
 		};
-	while (( optc = getopt_long(argc, argv, "a:p:r:m:n:t:g:e:hv", long_options, &option_index)) != -1) {
+	while (( optc = getopt_long(argc, argv, "a:p:r:B:b:P:m:n:t:g:e:f:s:wF:O:G:V:D:j:N:d:S:U:K:E:A:l:Z:i:o:u:T:c:C:k:R:x:q:M:hv", long_options, &option_index)) != -1) {
 		switch(optc) {
 			case 'a':
 				strncpy(address, optarg, 16);
@@ -80,13 +135,40 @@ int main(int argc, char *argv[]) {
 				printf("Port received: %d\n", servPort);
 				break;
 			case 'r':
-				sendRate = atof(optarg);
-				printf("Rate received: %f\n", sendRate);
+				if (parseRate(optarg) == -1) {
+					printf("ERROR: Rate must be a number or a fraction (e.g. 30000/1001)\n");
+					exit(0);
+				}
+				printf("Rate received: %s (%f)\n", optarg, sendRate);
 				if (sendRate > 1000000) {
 					printf("Values greater than 1,000,000 packets per second are not supported\n");
 					exit(0);
 				}
 				break;
+			case 'B':
+				bitRate = (uint64_t)(atof(optarg) * 1000000);
+				printf("Bit rate received: %s Mbps\n", optarg);
+				if (bitRate == 0 || bitRate > 100000000000ULL) {
+					printf("ERROR: Bit rate out of range (0,100000] Mbps\n");
+					exit(0);
+				}
+				break;
+			case 'b':
+				startBoundary = atoi(optarg);
+				printf("Start boundary received: %d seconds\n", startBoundary);
+				if (startBoundary < 0) {
+					printf("ERROR: Start boundary must be 0 or greater\n");
+					exit(0);
+				}
+				break;
+			case 'P':
+				if (sscanf(optarg, "%d/%d", &phaseSlot, &phaseSlots) != 2 || phaseSlots < 1 ||
+						phaseSlot < 0 || phaseSlot >= phaseSlots) {
+					printf("ERROR: Phase must be in the form slot/slots with 0 <= slot < slots\n");
+					exit(0);
+				}
+				printf("Phase received: %d/%d\n", phaseSlot, phaseSlots);
+				break;
 			case 'm':
 				strncpy(missionId, optarg, 12);
 				missionId[12] = '\0'; // Prevent buffer overrun
@@ -101,6 +183,7 @@ int main(int argc, char *argv[]) {
 				break;
 			case 't':
 				latitude = (uint32_t)htonl(mapLatitude(optarg));
+				latitudeDegrees = atof(optarg);
 				printf("Latitude received: %s\n", optarg);
 				if (atof(optarg) < -90.0 || atof(optarg) > 90.0) {
 					printf("ERROR: Latitude out of range (-90,90)\n");
@@ -109,6 +192,7 @@ int main(int argc, char *argv[]) {
 				break;
 			case 'g':
 				longitude = (uint32_t)htonl(mapLongitude(optarg));
+				longitudeDegrees = atof(optarg);
 				printf("Longitude received: %s\n", optarg);
 				if (atof(optarg) < -180.0 || atof(optarg) > 180.0) {
 					printf("ERROR: Longitude out of range (-180,180)\n");
@@ -117,12 +201,205 @@ int main(int argc, char *argv[]) {
 				break;
 			case 'e':
 				altitude = (uint16_t)htons(mapAltitude(optarg));
+				altitudeMeters = atof(optarg);
 				printf("Altitude received: %s\n", optarg);
 				if (atof(optarg) < -900 || atof(optarg) > 19000) {
 					printf("ERROR: Altitude out of range(-900,19000)\n");
 					exit(0);
 				}
 				break;
+#ifndef WIN32
+			case 'f':
+				strncpy(replayFile, optarg, sizeof(replayFile));
+				replayFile[sizeof(replayFile) - 1] = '\0'; // Prevent buffer overrun
+				printf("Replay file received: %s\n", replayFile);
+				break;
+			case 's':
+				replaySpeed = atof(optarg);
+				printf("Replay speed received: %f\n", replaySpeed);
+				if (replaySpeed < 0) {
+					printf("ERROR: Replay speed must be 0 or greater\n");
+					exit(0);
+				}
+				break;
+			case 'w':
+				replayRewrite = 1;
+				printf("Rewriting replayed timestamps\n");
+				break;
+			case 'i':
+				indexBuildGranularity = (uint64_t)(atof(optarg) * 1e6);
+				if (indexBuildGranularity == 0) {
+					printf("ERROR: Index granularity must be a positive number of seconds\n");
+					exit(0);
+				}
+				printf("Index granularity received: %s seconds\n", optarg);
+				break;
+			case 'o':
+				strncpy(indexFrom, optarg, 31);
+				printf("Replay from received: %s\n", indexFrom);
+				break;
+			case 'u':
+				strncpy(indexUntil, optarg, 31);
+				printf("Replay until received: %s\n", indexUntil);
+				break;
+			case 'F':
+				strncpy(frameSource, optarg, sizeof(frameSource));
+				frameSource[sizeof(frameSource) - 1] = '\0'; // Prevent buffer overrun
+				printf("Frame source received: %s\n", frameSource);
+				break;
+#endif
+			case 'O':
+				orbitRadius = atof(optarg);
+				printf("Orbit radius received: %f\n", orbitRadius);
+				if (orbitRadius < 0) {
+					printf("ERROR: Orbit radius must be 0 or greater\n");
+					exit(0);
+				}
+				break;
+			case 'G':
+				orbitSpeed = atof(optarg);
+				printf("Ground speed received: %f\n", orbitSpeed);
+				if (orbitSpeed < 1 || orbitSpeed > 255) {
+					printf("ERROR: Ground speed out of range (1,255)\n");
+					exit(0);
+				}
+				break;
+			case 'V':
+				if (sscanf(optarg, "%lfx%lf", &sensorHorizontalFov, &sensorVerticalFov) < 2)
+					sensorVerticalFov = sensorHorizontalFov * 9 / 16;
+				printf("Field of view received: %f x %f\n", sensorHorizontalFov, sensorVerticalFov);
+				if (sensorHorizontalFov <= 0 || sensorHorizontalFov > 180 || sensorVerticalFov <= 0 || sensorVerticalFov > 180) {
+					printf("ERROR: Field of view out of range (0,180)\n");
+					exit(0);
+				}
+				break;
+			case 'D':
+				strncpy(demDirectory, optarg, sizeof(demDirectory));
+				demDirectory[sizeof(demDirectory) - 1] = '\0'; // Prevent buffer overrun
+				printf("DEM directory received: %s\n", demDirectory);
+				break;
+#ifndef WIN32
+			case 'j':
+				coordWorkers = atoi(optarg);
+				printf("Workers received: %d\n", coordWorkers);
+				if (coordWorkers < 1 || coordWorkers > COORD_WORKER_MAX) {
+					printf("ERROR: Workers out of range (1,%d)\n", COORD_WORKER_MAX);
+					exit(0);
+				}
+				break;
+			case 'N':
+				coordStreams = atoi(optarg);
+				printf("Streams received: %d\n", coordStreams);
+				if (coordStreams < 1 || coordStreams > COORD_STREAM_MAX) {
+					printf("ERROR: Streams out of range (1,%d)\n", COORD_STREAM_MAX);
+					exit(0);
+				}
+				break;
+			case 'd':
+				if (strlen(optarg) >= sizeof(daemonSocket)) {
+					printf("ERROR: Control socket path longer than %d characters\n", (int)sizeof(daemonSocket) - 1);
+					exit(0);
+				}
+				strcpy(daemonSocket, optarg);
+				printf("Control socket received: %s\n", daemonSocket);
+				break;
+#endif
+			case 'K':
+				if (parseClockModel(optarg) == -1) {
+					printf("ERROR: Clock model must be comma separated offset=, drift=, walk=, step=<s>:<ms>, seed=\n");
+					exit(0);
+				}
+				printf("Clock model received: %s\n", optarg);
+				break;
+			case 'E':
+				if (exprAddField(optarg) == -1) {
+					printf("ERROR: Expressions must be lat=, lon=, alt=, mission= or platform=, at most %d\n", EXPR_FIELD_MAX);
+					exit(0);
+				}
+				printf("Expression received: %s\n", optarg);
+				break;
+			case 'A':
+				if (parseBehavior(optarg) == -1) {
+					printf("ERROR: Behaviors must be comma separated takeoff=, goto=, loiter=, rtb, repeat, speed=, climb=, stagger=, spacing=\n");
+					exit(0);
+				}
+				printf("Behavior received: %s\n", optarg);
+				break;
+			case 'T':
+				vmtiTargets = atoi(optarg);
+				printf("VMTI targets received: %d\n", vmtiTargets);
+				if (vmtiTargets < 0 || vmtiTargets > VMTI_TARGET_MAX) {
+					printf("ERROR: VMTI targets out of range (0,%d)\n", VMTI_TARGET_MAX);
+					exit(0);
+				}
+				break;
+			case 'c':
+				securityClassification = parseClassification(optarg);
+				if (securityClassification == 0) {
+					printf("ERROR: Unknown classification %s\n", optarg);
+					exit(0);
+				}
+				printf("Classification received: %s\n", optarg);
+				break;
+			case 'C':
+				strncpy(securityCountry, optarg, SECURITY_STRING_MAX);
+				if (strlen(optarg) > SECURITY_STRING_MAX) printf("WARNING: Classifying country truncated to %d characters\n", SECURITY_STRING_MAX);
+				printf("Classifying country received: %s\n", securityCountry);
+				break;
+			case 'k':
+				strncpy(securityCaveats, optarg, SECURITY_STRING_MAX);
+				if (strlen(optarg) > SECURITY_STRING_MAX) printf("WARNING: Caveats truncated to %d characters\n", SECURITY_STRING_MAX);
+				printf("Caveats received: %s\n", securityCaveats);
+				break;
+			case 'R':
+				strncpy(securityReleasing, optarg, SECURITY_STRING_MAX);
+				if (strlen(optarg) > SECURITY_STRING_MAX) printf("WARNING: Releasing instructions truncated to %d characters\n", SECURITY_STRING_MAX);
+				printf("Releasing instructions received: %s\n", securityReleasing);
+				break;
+#ifdef __gnu_linux__
+			case 'x':
+				strncpy(xdpInterface, optarg, IFNAMSIZ);
+				xdpInterface[IFNAMSIZ - 1] = '\0'; // Prevent buffer overrun
+				printf("XDP interface received: %s\n", xdpInterface);
+				break;
+			case 'q':
+				xdpQueue = atoi(optarg);
+				printf("XDP queue received: %d\n", xdpQueue);
+				break;
+			case 'M':
+				if (parseMac(optarg, xdpDstMac) == -1) {
+					printf("ERROR: Destination MAC must be in the form aa:bb:cc:dd:ee:ff\n");
+					exit(0);
+				}
+				printf("Destination MAC received: %s\n", optarg);
+				break;
+			case 'S':
+				strncpy(txstampMode, optarg, sizeof(txstampMode));
+				txstampMode[sizeof(txstampMode) - 1] = '\0'; // Prevent buffer overrun
+				printf("TX timestamps received: %s\n", txstampMode);
+				break;
+			case 'U':
+				if (parseTransport(optarg) == -1) {
+					printf("ERROR: Transport must be sendto, sendmmsg or gso with an optional :batch (1-%d), or auto[:null]\n", PACKET_BATCH_MAX);
+					exit(0);
+				}
+				printf("Transport received: %s\n", optarg);
+				break;
+			case 'l':
+				if (parseReceiver(optarg) == -1) {
+					printf("ERROR: Receiver threads must be 1-%d, optionally followed by :cpu\n", RECV_THREAD_MAX);
+					exit(0);
+				}
+				printf("Receiver received: %s\n", optarg);
+				break;
+			case 'Z':
+				if (parseState(optarg) == -1) {
+					printf("ERROR: State table must be <name>[:capacity], capacity a power of 2\n");
+					exit(0);
+				}
+				printf("State table received: %s\n", optarg);
+				break;
+#endif
 			case 'h':
 				help();
 				exit(0);
@@ -136,8 +413,117 @@ int main(int argc, char *argv[]) {
 				exit(0);
 		}
 	}
+	// -p may come after -N
+	if (servPort + coordStreams > 65536) {
+		printf("ERROR: %d streams from port %d don't fit below port 65536\n", coordStreams, servPort);
+		exit(0);
+	}
 	
+#ifdef __gnu_linux__
+	if (recvThreads > 0) {
+		if (recvRun() == -1) exit(-1);
+		exit(0);
+	}
+	if (stateName[0] != '\0') {
+		if (stateDump() == -1) exit(-1);
+		exit(0);
+	}
+#endif
+	initPacketTemplate();
+	if (exprInit() == -1) exit(0);
+#ifdef __gnu_linux__
+	if (txstampMode[0] != '\0' && (coordWorkers > 0 || xdpInterface[0] != '\0')) {
+		printf("ERROR: TX timestamps are read from the generator's own socket, not from workers or XDP\n");
+		exit(0);
+	}
+	if (txstampMode[0] != '\0' && clockEnabled) {
+		printf("ERROR: TX timestamp latencies are measured from the embedded timestamp, which a clock model moves\n");
+		exit(0);
+	}
+#endif
+#ifndef WIN32
+	if (clockEnabled && (daemonSocket[0] != '\0' || replayFile[0] != '\0' || frameSource[0] != '\0')) {
+		printf("ERROR: Clock models apply to generated streams, daemon jobs, replay and frame ticks keep their own time\n");
+		exit(0);
+	}
+#endif
+	if (clockModelInit(coordWorkers > 0 ? (coordStreams > 0 ? coordStreams : coordWorkers) : 1) == -1) exit(-1);
+#ifndef WIN32
+	if (behaviorEnabled && (daemonSocket[0] != '\0' || replayFile[0] != '\0')) {
+		printf("ERROR: Behaviors fly generated streams, not daemon jobs or replay\n");
+		exit(0);
+	}
+#endif
+	if (behaviorCheck(coordWorkers > 0 ? (coordStreams > 0 ? coordStreams : coordWorkers) : 1) == -1) exit(0);
+	// Workers set up the frames of their own streams
+	if (coordWorkers == 0 && behaviorInit(0, 1) == -1) exit(-1);
+#ifndef WIN32
+	if (bitRate > 0 && (coordWorkers > 0 || daemonSocket[0] != '\0' || frameSource[0] != '\0')) {
+		printf("ERROR: A bit rate paces this process's own stream, not workers, daemon jobs or frame ticks\n");
+		exit(0);
+	}
+	if (daemonSocket[0] != '\0' && (coordWorkers > 0 || replayFile[0] != '\0' || frameSource[0] != '\0' ||
+			attitudeSetLength > 0 || footprintSetLength > 0 || vmtiSetLength > 0 || exprFieldCount > 0)) {
+		printf("ERROR: Daemon jobs can't be combined with workers, replay, frame ticks, orbit, footprint, VMTI or expressions\n");
+		exit(0);
+	}
+	if (coordWorkers > 0 && (replayFile[0] != '\0' || frameSource[0] != '\0')) {
+		printf("ERROR: Workers generate streams, they can't replay or follow frame ticks\n");
+		exit(0);
+	}
+	if (indexBuildGranularity > 0) {
+		if (replayFile[0] == '\0') {
+			printf("ERROR: The index is built for a replay file, give it with -f\n");
+			exit(0);
+		}
+		if (replayOpen() == -1 || klvIndexBuild(indexBuildGranularity) == -1) exit(-1);
+		exit(0);
+	}
+	if ((indexFrom[0] != '\0' || indexUntil[0] != '\0') && replayFile[0] == '\0') {
+		printf("ERROR: A time range applies to replay, give the file with -f\n");
+		exit(0);
+	}
+#endif
+	// Calibration floods the destination, so only once the options are known to work
+#ifdef __gnu_linux__
+	if (calibrateMode > 0 && xdpInterface[0] == '\0' && calibrateRun() == -1) exit(-1);
+#endif
+#ifndef WIN32
+	if (daemonSocket[0] != '\0') {
+		if (udpInit() == -1 || daemonRun() == -1) exit(-1);
+		exit(0);
+	}
+	if (coordWorkers > 0) {
+		if (coordRun() == -1) exit(-1);
+		exit(0);
+	}
+#endif
+#ifdef __gnu_linux__
+	if (xdpInterface[0] != '\0') {
+		if (xdpInit() == -1) exit(-1);
+		xdpRun();
+	}
+#endif
 	if (udpInit() == -1) exit(-1);
+#ifndef WIN32
+	if (replayFile[0] != '\0') {
+		if (replayRun() == -1) exit(-1);
+		exitProgram();
+	}
+	if (frameSource[0] != '\0') {
+		if (frameRun() == -1) exit(-1);
+		exitProgram();
+	}
+#endif
+	if (bitRate > 0) {
+		udpSendBitRate();
+		exit(-1);
+	}
+	if (sendRate <= 0) {
+		sleepUntil(streamStartTime(0));
+		udpFlood();
+		exit(-1);
+	}
 	
 	// TESTING ================================================================
 	int i;
@@ -163,15 +549,39 @@ int main(int argc, char *argv[]) {
 		printf("Testing makePacket, packetBuffer:\n");
 		printf(" K  L  Value...\n");
 		makePacket(packetBuffer);
-		for (i = 0; i < 80; ++i) {
+		for (i = 0; i < packetLength; ++i) {
 			printf("%2X ", packetBuffer[i]);
 			if ((i == 15) || (i == 25) || (i == 39) || (i == 53) || (i == 59) || (i == 65) || (i == 69) || (i == 72)) {
 				printf("\n");
 			}
 		}
 		printf("\n");
+		struct klvPacket decoded;
+		int decodedLength = klvDecode(packetBuffer, packetLength, &decoded);
+		printf("klvDecode: %d, %d items, lat %f, lon %f, alt %f\n", decodedLength, decoded.count,
+				klvLatitude(&decoded), klvLongitude(&decoded), klvAltitude(&decoded));
 		udpSendPacket((const char *)packetBuffer);
 	}
+	if (DEBUG) {
+		// Junk, a packet, a truncated packet, then the packet again
+		struct klvScanner scanner;
+		struct klvPacket scanned;
+		size_t room;
+		unsigned char *space;
+		if (klvScannerInit(&scanner) == 0) {
+			space = klvScannerSpace(&scanner, &room);
+			memcpy(&space[0], "junk", 4);
+			memcpy(&space[4], packetBuffer, packetLength);
+			memcpy(&space[4 + packetLength], packetBuffer, 30);
+			memcpy(&space[34 + packetLength], packetBuffer, packetLength);
+			klvScannerCommit(&scanner, 34 + 2 * packetLength);
+			while (klvScannerNext(&scanner, &scanned) == 1);
+			printf("Testing klvScannerNext: %llu packets, %llu bytes skipped, %llu rejected\n",
+					(unsigned long long)scanner.packets, (unsigned long long)scanner.skippedBytes,
+					(unsigned long long)scanner.rejected);
+			free(scanner.buff);
+		}
+	}
 	if (DEBUG) {
 		printf("Testing htonll function:\n num: 0x 01 02 03 04 05 06 07 08\n");
 		uint64_t number = 0x0102030405060708ULL;
@@ -199,13 +609,21 @@ int main(int argc, char *argv[]) {
 	}
 	// END TESTING==========================================================
 	
+	struct ratePacer pacer;
+	ratePacerInit(&pacer);
+	motionPaced = 1;
 	while (1) {
-		timestamp = htonll(updateTimestamp());
+		sleepUntil(pacer.deadline);
+#ifdef __gnu_linux__
+		txstampScheduled = pacer.deadline;
+#endif
+		ratePacerNext(&pacer);
+		timestamp = htonll(clockModelTime(0, updateTimestamp()));
 		makePacket(packetBuffer);
 		udpSendPacket((const char *)packetBuffer);
 		if (DEBUG) {
 			printf("\n K  L  Value...\n");
-			for (i = 0; i < 80; ++i) {
+			for (i = 0; i < packetLength; ++i) {
 				printf("%2X ", packetBuffer[i]);
 				if ((i == 16) || (i == 26) || (i == 40) || (i == 54) || 
 						(i == 60) || (i == 66) || (i == 70) || (i == 73)) {
@@ -213,10 +631,5 @@ int main(int argc, char *argv[]) {
 				}
 			}
 		}
-#ifdef WIN32
-		Sleep((1 / sendRate) * 1000);
-#else
-		usleep((1 / sendRate) * 1000); // usleep is untested, may not compile
-#endif
 	}
 }
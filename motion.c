@@ -0,0 +1,169 @@
+//============================================================================
+//		Platform trajectory and attitude
+// Flies the platform around a circular orbit centered on the configured
+// position, at a constant ground speed and altitude, and derives the ST 0601
+// attitude tags from the orbit each packet:
+// Platform Heading (5): tangent to the orbit, clockwise as seen from above
+// Platform Pitch (6): 0, level flight
+// Platform Roll (7): bank of a coordinated turn, atan(v^2 / (g r))
+// Sensor Relative Azimuth/Elevation/Roll (18-20): sensor pointed at the
+//   orbit center, right of the nose and below the horizon
+// Platform Ground Speed (56): the configured speed
+// Sensor Latitude/Longitude (13, 14) follow the platform around the orbit,
+// and the footprint tags (geometry.c) follow the line of sight.
+//
+// Only the orbit angle changes between packets, so its cosine and sine are
+// advanced with a rotation recurrence. The step's rotation is computed once
+// and reused while the step stays the same, and the exact values are
+// restored every MOTION_RESYNC steps to bound rounding drift. Wakeups of the
+// paced loop jitter by microseconds, so there the platform moves in whole
+// periods of the exact rate, to the tick nearest the packet's time, and the
+// step is the same every packet.
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#define MOTION_GRAVITY 9.80665
+#define MOTION_EARTH_RADIUS 6378137.0 // WGS 84 equatorial radius, meters
+#define MOTION_RESYNC 4096
+#define MOTION_RADIANS (M_PI / 180.0)
+
+//============================================================================
+
+double orbitRadius; // Meters, 0 = stationary platform without attitude tags
+double orbitSpeed = 40.0; // Ground speed, meters per second
+unsigned char attitudeSet[40]; // Tags 5, 6, 7, 18, 19, 20 and 56
+int attitudeSetLength;
+int motionLength; // Bytes from tag 13 to the end of footprintSet, rewritten per packet
+uint32_t motionTemplateSum; // Checksum contribution of those bytes in packetTemplate
+
+// Orbit state, the angle is clockwise from north around the center
+double motionAngle;
+double motionCos;
+double motionSin;
+double motionStepCos; // Rotation for a step of motionStepLength
+double motionStepSin;
+uint64_t motionStepLength; // Microseconds, or periods when paced
+uint64_t motionTime; // Time of the current angle, 0 before the first packet
+int motionPaced; // Packets are sent at the exact rate, set by the paced loop
+uint64_t motionTicks; // Periods from the first packet to the current angle, when paced
+uint32_t motionSteps;
+double motionLongitudeScale; // Meters east to degrees of longitude at the center
+
+// Constant around the orbit, degrees. A stationary platform is level, looking straight down.
+double motionRoll;
+double motionSensorAzimuth;
+double motionSensorElevation = -90;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Maps a signed value onto +/-scale for the range +/-range, rounded
+int64_t mapSigned(double value, double range, double scale) {
+	if (value > range) value = range;
+	if (value < -range) value = -range;
+	return (int64_t)floor(value / range * scale + 0.5);
+}
+
+//--------------------------------------------------
+// Encode the attitude tags. The bank and sensor angles are constant around
+// the orbit, the heading is written per packet by updateMotionFields().
+void encodeAttitudeSet(void) {
+	double depression;
+	int len = 0;
+
+	attitudeSetLength = 0;
+	if (orbitRadius <= 0) return;
+	motionAngle = 0;
+	motionCos = 1;
+	motionSin = 0;
+	motionTime = motionStepLength = motionTicks = 0;
+	motionSteps = 0;
+	motionLongitudeScale = 1 / (MOTION_EARTH_RADIUS * cos(latitudeDegrees * MOTION_RADIANS) * MOTION_RADIANS);
+
+	motionRoll = atan(orbitSpeed * orbitSpeed / (MOTION_GRAVITY * orbitRadius)) / MOTION_RADIANS;
+	// Angle below the horizon to the orbit center, the banked airframe already covers roll of it
+	depression = atan((altitudeMeters - demElevation(latitudeDegrees, longitudeDegrees)) / orbitRadius) / MOTION_RADIANS;
+	motionSensorAzimuth = 90;
+	motionSensorElevation = motionRoll - depression;
+
+	len = appendUintItem(attitudeSet, len, 0x05, 0, 2);
+	len = appendUintItem(attitudeSet, len, 0x06, 0, 2);
+	len = appendUintItem(attitudeSet, len, 0x07, (uint16_t)mapSigned(motionRoll, 50, 32767), 2);
+	len = appendUintItem(attitudeSet, len, 0x12, (uint32_t)(motionSensorAzimuth / 360.0 * 4294967295.0), 4);
+	len = appendUintItem(attitudeSet, len, 0x13, (uint32_t)mapSigned(motionSensorElevation, 180, 2147483647), 4);
+	len = appendUintItem(attitudeSet, len, 0x14, 0, 4);
+	len = appendUintItem(attitudeSet, len, 0x38, (uint32_t)floor(orbitSpeed + 0.5), 1);
+	attitudeSetLength = len;
+}
+
+//--------------------------------------------------
+// Moves the platform to the given time (microseconds) along the orbit,
+// returns 0 if it hasn't moved
+int motionAdvance(uint64_t time) {
+	uint64_t elapsed, ticks;
+	double step, c;
+
+	if (motionTime == 0 || time <= motionTime) {
+		if (motionTime == 0) motionTime = time;
+		return 0;
+	}
+	if (motionPaced) {
+		// motionTime stays at the first packet, the ticks count from it
+		ticks = (uint64_t)floor((time - motionTime) * (double)rateNumerator / (rateDenominator * 1e6) + 0.5);
+		if (ticks <= motionTicks) return 0;
+		elapsed = ticks - motionTicks;
+		motionTicks = ticks;
+		step = orbitSpeed / orbitRadius * ((double)elapsed * rateDenominator / rateNumerator);
+	}
+	else {
+		elapsed = time - motionTime;
+		motionTime = time;
+		step = orbitSpeed / orbitRadius * (elapsed / 1e6);
+	}
+	motionAngle = fmod(motionAngle + step, 2 * M_PI);
+	if (++motionSteps % MOTION_RESYNC == 0) {
+		motionCos = cos(motionAngle);
+		motionSin = sin(motionAngle);
+		return 1;
+	}
+	if (elapsed != motionStepLength) {
+		motionStepLength = elapsed;
+		motionStepCos = cos(step);
+		motionStepSin = sin(step);
+	}
+	c = motionCos * motionStepCos - motionSin * motionStepSin;
+	motionSin = motionSin * motionStepCos + motionCos * motionStepSin;
+	motionCos = c;
+	return 1;
+}
+
+//--------------------------------------------------
+// Writes the position and heading at the given time (microseconds) into a
+// packet, buff points at the tag 13 byte
+void updateMotionFields(unsigned char *buff, uint64_t time) {
+	double lat, lon, heading;
+	uint32_t netLat, netLon;
+	uint16_t netHeading;
+	int moved = motionAdvance(time);
+
+	lat = latitudeDegrees + orbitRadius * motionCos / (MOTION_EARTH_RADIUS * MOTION_RADIANS);
+	lon = longitudeDegrees + orbitRadius * motionSin * motionLongitudeScale;
+	if (lon > 180) lon -= 360;
+	if (lon < -180) lon += 360;
+	heading = motionAngle / MOTION_RADIANS + 90;
+	if (heading >= 360) heading -= 360;
+
+	netLat = htonl((uint32_t)mapSigned(lat, 90, 2147483647));
+	netLon = htonl((uint32_t)mapSigned(lon, 180, 2147483647));
+	netHeading = htons((uint16_t)floor(heading / 360 * 65535 + 0.5));
+	memcpy(&buff[2], &netLat, 4);
+	memcpy(&buff[8], &netLon, 4);
+	memcpy(&buff[16 + 2], &netHeading, 2);
+	// Packets of a batch often share a time, the footprint is only traced again after a move
+	if (footprintSetLength > 0) {
+		if (moved) updateFootprintSet(lat, lon, heading);
+		memcpy(&buff[16 + attitudeSetLength], footprintSet, footprintSetLength);
+	}
+}
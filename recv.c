@@ -0,0 +1,453 @@
+//============================================================================
+//		Receiver
+// Receives and checks streams instead of generating them, to test a
+// generator's output at full rate (Linux only). -l <threads> starts that
+// many receiver threads, each with its own UDP socket on every listening
+// port (-p, and -N ports from it), grouped with SO_REUSEPORT so the kernel
+// spreads the flows between them. -l <threads>:cpu attaches a classic BPF
+// program to each group that picks the socket by the receiving CPU, and
+// pins thread i to CPU i, so a packet is read on the CPU that took its
+// interrupt.
+//
+// Each thread decodes its packets with klvDecode() and keeps its own
+// open-addressing table of streams, keyed by mission ID (tag 3), platform
+// (tag 10) and port, with per-stream counts, losses and latency:
+// lost: packets the span of embedded timestamps should hold at the
+//   stream's usual step (a moving average of the steps near it) less those
+//   received. The packets carry no sequence number, so this is an estimate,
+//   but a sender catching up on late ticks evens out.
+// reordered: packets older than one already received
+// latency: arrival (realtime, per received batch) minus the embedded
+//   timestamp, so it includes any clock model offset
+// Only the owning thread writes a table, nothing is locked. The report,
+// every second and at exit, folds the threads' tables into one, so a stream
+// seen by more than one thread is counted once; the final report lists the
+// streams with the most losses. With -Z the threads also keep each
+// platform's latest state in shared memory (state.c).
+//
+// Example usage: ./klvgen -l 4:cpu -p 9000 -N 64
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifdef __gnu_linux__
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+
+#define RECV_THREAD_MAX 64
+#define RECV_BATCH 64 // Datagrams per recvmmsg()
+#define RECV_TABLE_SIZE (1 << 18) // Streams per table, a power of 2
+#define RECV_NAME_MAX 16 // Name bytes kept for the report
+#define RECV_SOCKET_BUFFER (4 * 1024 * 1024)
+#define RECV_REPORT_INTERVAL 1000000000ULL
+#define RECV_WORST 10 // Streams listed in the final report
+#define RECV_RESEED 8 // Steps in a row outside half to twice the average that replace it
+
+//============================================================================
+
+// State of one stream, the key is published last so a reporter only sees
+// filled entries
+struct recvStream {
+	uint64_t key; // 0 = empty
+	uint16_t port;
+	char mission[RECV_NAME_MAX];
+	char platform[RECV_NAME_MAX];
+	uint64_t packets;
+	uint64_t reordered;
+	uint64_t firstTime; // Oldest and newest embedded timestamps, microseconds
+	uint64_t lastTime;
+	uint64_t step; // Moving average timestamp step, microseconds
+	uint32_t outliers; // Steps in a row far from step, enough of them reseed it
+	uint64_t lost; // Filled in by recvMerge()
+	int64_t latencySum; // Microseconds
+	int64_t latencyMax;
+};
+
+// Counters of one thread, alone on a cache line
+struct recvCounters {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t malformed; // Failed klvDecode()
+	uint64_t untracked; // Stream or state table full
+} __attribute__((aligned(64)));
+
+struct recvThread {
+	struct recvCounters counters;
+	pthread_t thread;
+	int index;
+	int epoll;
+	struct recvStream *table;
+};
+
+int recvThreads; // 0 = generate instead
+int recvSteer; // Steer by CPU with a BPF program
+struct recvThread recvState[RECV_THREAD_MAX];
+struct recvStream *recvMerged; // Report table
+volatile sig_atomic_t recvStop;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Parses <threads>[:cpu], returns -1 if malformed
+int parseReceiver(const char *str) {
+	char *end;
+	recvThreads = strtol(str, &end, 10);
+	if (end == str || recvThreads < 1 || recvThreads > RECV_THREAD_MAX) return -1;
+	if (strcmp(end, ":cpu") == 0) recvSteer = 1;
+	else if (*end != '\0') return -1;
+	return 0;
+}
+
+//--------------------------------------------------
+// Stops the threads and the report loop
+void recvHandleSignal(int sig) {
+	recvStop = 1;
+}
+
+//--------------------------------------------------
+// Hashes a stream's identity (FNV-1a), never 0
+uint64_t recvKey(const unsigned char *mission, int missionLength, const unsigned char *platform,
+		int platformLength, uint16_t port) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	int i;
+
+	for (i = 0; i < missionLength; ++i) hash = (hash ^ mission[i]) * 0x100000001B3ULL;
+	hash = (hash ^ 0x100) * 0x100000001B3ULL;
+	for (i = 0; i < platformLength; ++i) hash = (hash ^ platform[i]) * 0x100000001B3ULL;
+	hash = (hash ^ port) * 0x100000001B3ULL;
+	return hash != 0 ? hash : 1;
+}
+
+//--------------------------------------------------
+// Finds a stream in a table by linear probing, or the empty entry it goes
+// in. Returns NULL if the table is full.
+struct recvStream *recvLookup(struct recvStream *table, uint64_t key) {
+	uint32_t i = (uint32_t)(key ^ (key >> 32)) & (RECV_TABLE_SIZE - 1);
+	uint32_t probes;
+	uint64_t found;
+
+	for (probes = 0; probes < RECV_TABLE_SIZE; ++probes) {
+		found = __atomic_load_n(&table[i].key, __ATOMIC_ACQUIRE);
+		if (found == key || found == 0) return &table[i];
+		i = (i + 1) & (RECV_TABLE_SIZE - 1);
+	}
+	return NULL;
+}
+
+//--------------------------------------------------
+// Copies a name view for the report, NUL terminated
+void recvCopyName(char *name, const struct klvPacket *pkt, const struct klvView *view) {
+	int length = 0;
+	if (view != NULL) {
+		length = view->length < RECV_NAME_MAX - 1 ? view->length : RECV_NAME_MAX - 1;
+		memcpy(name, &pkt->buff[view->offset], length);
+	}
+	name[length] = '\0';
+}
+
+//--------------------------------------------------
+// Decodes one datagram and updates its stream, now is the arrival time in
+// microseconds
+void recvPacket(struct recvThread *t, const unsigned char *buff, int length, uint16_t port, uint64_t now) {
+	struct klvPacket pkt;
+	const struct klvView *mission, *platform;
+	struct recvStream *s;
+	uint64_t key, time, gap;
+	int64_t latency;
+
+	if (klvDecode(buff, length, &pkt) < 0) {
+		__atomic_store_n(&t->counters.malformed, t->counters.malformed + 1, __ATOMIC_RELAXED);
+		return;
+	}
+	mission = klvFind(&pkt, 0x03);
+	platform = klvFind(&pkt, 0x0A);
+	key = recvKey(mission != NULL ? &buff[mission->offset] : NULL, mission != NULL ? mission->length : 0,
+			platform != NULL ? &buff[platform->offset] : NULL, platform != NULL ? platform->length : 0, port);
+	if (stateTable != NULL && stateUpdate(key, &pkt, mission, platform, port, now) == -1)
+		__atomic_store_n(&t->counters.untracked, t->counters.untracked + 1, __ATOMIC_RELAXED);
+	s = recvLookup(t->table, key);
+	if (s == NULL) {
+		__atomic_store_n(&t->counters.untracked, t->counters.untracked + 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (s->key == 0) {
+		s->port = port;
+		recvCopyName(s->mission, &pkt, mission);
+		recvCopyName(s->platform, &pkt, platform);
+		__atomic_store_n(&s->key, key, __ATOMIC_RELEASE);
+	}
+
+	// Only this thread writes the entry, the stores are atomic for the reporter
+	time = klvTimestamp(&pkt);
+	if (s->packets == 0) {
+		__atomic_store_n(&s->firstTime, time, __ATOMIC_RELAXED);
+		__atomic_store_n(&s->lastTime, time, __ATOMIC_RELAXED);
+	}
+	else if (time > s->lastTime) {
+		gap = time - s->lastTime;
+		if (gap * 2 >= s->step && gap <= s->step * 2) {
+			__atomic_store_n(&s->step, s->step + ((int64_t)gap - (int64_t)s->step) / 16, __ATOMIC_RELAXED);
+			s->outliers = 0;
+		}
+		else if (s->step == 0 || ++s->outliers == RECV_RESEED) {
+			__atomic_store_n(&s->step, gap, __ATOMIC_RELAXED);
+			s->outliers = 0;
+		}
+		__atomic_store_n(&s->lastTime, time, __ATOMIC_RELAXED);
+	}
+	else if (time < s->lastTime) {
+		__atomic_store_n(&s->reordered, s->reordered + 1, __ATOMIC_RELAXED);
+		if (time < s->firstTime) __atomic_store_n(&s->firstTime, time, __ATOMIC_RELAXED);
+	}
+	latency = (int64_t)(now - time);
+	__atomic_store_n(&s->latencySum, s->latencySum + latency, __ATOMIC_RELAXED);
+	if (latency > s->latencyMax) __atomic_store_n(&s->latencyMax, latency, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->packets, s->packets + 1, __ATOMIC_RELAXED);
+}
+
+//--------------------------------------------------
+// Receiver thread: reads its sockets in batches until stopped
+void *recvThreadRun(void *arg) {
+	struct recvThread *t = arg;
+	unsigned char (*buffers)[PACKET_MAX] = malloc(sizeof(*buffers) * RECV_BATCH);
+	struct mmsghdr msgs[RECV_BATCH];
+	struct iovec iovs[RECV_BATCH];
+	struct epoll_event events[RECV_BATCH];
+	struct timespec ts;
+	cpu_set_t cpus;
+	uint64_t now, bytes;
+	int i, j, n, m, fd;
+
+	if (buffers == NULL) {
+		printf("ERROR: Unable to allocate receive buffers\n");
+		recvStop = 1;
+		return NULL;
+	}
+	if (recvSteer) {
+		CPU_ZERO(&cpus);
+		CPU_SET(t->index, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+			printf("WARNING: Unable to pin receiver thread %d to its CPU\n", t->index);
+	}
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < RECV_BATCH; ++i) {
+		iovs[i].iov_base = buffers[i];
+		iovs[i].iov_len = PACKET_MAX;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (!recvStop) {
+		n = epoll_wait(t->epoll, events, RECV_BATCH, 100);
+		for (i = 0; i < n; ++i) {
+			fd = (int)(events[i].data.u64 >> 32);
+			do {
+				m = recvmmsg(fd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+				if (m <= 0) break;
+				clock_gettime(CLOCK_REALTIME, &ts);
+				now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+				for (bytes = 0, j = 0; j < m; ++j) {
+					recvPacket(t, buffers[j], msgs[j].msg_len, (uint16_t)events[i].data.u64, now);
+					bytes += msgs[j].msg_len;
+				}
+				__atomic_store_n(&t->counters.packets, t->counters.packets + m, __ATOMIC_RELAXED);
+				__atomic_store_n(&t->counters.bytes, t->counters.bytes + bytes, __ATOMIC_RELAXED);
+			} while (m == RECV_BATCH);
+		}
+	}
+	free(buffers);
+	return NULL;
+}
+
+//--------------------------------------------------
+// Opens the SO_REUSEPORT group of one port, a socket per thread in thread
+// order so the steering program's index is the thread. Returns -1 on failure.
+int recvOpenPort(uint16_t port) {
+	struct sock_filter code[] = {
+		{BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU},
+		{BPF_ALU | BPF_MOD | BPF_K, 0, 0, recvThreads},
+		{BPF_RET | BPF_A, 0, 0, 0}
+	};
+	struct sock_fprog program = {sizeof(code) / sizeof(code[0]), code};
+	struct sockaddr_in addr;
+	struct epoll_event event;
+	int i, fd, one = 1, buffer = RECV_SOCKET_BUFFER;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	for (i = 0; i < recvThreads; ++i) {
+		fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+				bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			perror("Unable to open receiver socket");
+			return -1;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+		if (recvSteer && i == 0 && setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) != 0) {
+			perror("Unable to attach the CPU steering program");
+			return -1;
+		}
+		event.events = EPOLLIN;
+		event.data.u64 = ((uint64_t)fd << 32) | port;
+		if (epoll_ctl(recvState[i].epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+			perror("Unable to watch receiver socket");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Folds every thread's table into recvMerged, returns the number of streams
+int recvMerge(uint64_t *untracked) {
+	struct recvStream *from, *to;
+	int64_t latencyMax;
+	uint64_t time, expected;
+	int i, t, streams = 0;
+
+	memset(recvMerged, 0, sizeof(*recvMerged) * RECV_TABLE_SIZE);
+	for (t = 0; t < recvThreads; ++t) {
+		for (i = 0; i < RECV_TABLE_SIZE; ++i) {
+			from = &recvState[t].table[i];
+			if (__atomic_load_n(&from->key, __ATOMIC_ACQUIRE) == 0) continue;
+			to = recvLookup(recvMerged, from->key);
+			if (to == NULL) {
+				(*untracked)++;
+				continue;
+			}
+			if (to->key == 0) {
+				*to = *from;
+				to->packets = to->reordered = to->latencySum = to->latencyMax = to->lastTime = 0;
+				to->firstTime = UINT64_MAX;
+				streams++;
+			}
+			to->packets += __atomic_load_n(&from->packets, __ATOMIC_RELAXED);
+			to->reordered += __atomic_load_n(&from->reordered, __ATOMIC_RELAXED);
+			time = __atomic_load_n(&from->firstTime, __ATOMIC_RELAXED);
+			if (time < to->firstTime) to->firstTime = time;
+			time = __atomic_load_n(&from->lastTime, __ATOMIC_RELAXED);
+			if (time > to->lastTime) to->lastTime = time;
+			time = __atomic_load_n(&from->step, __ATOMIC_RELAXED);
+			if (time > to->step) to->step = time;
+			to->latencySum += __atomic_load_n(&from->latencySum, __ATOMIC_RELAXED);
+			latencyMax = __atomic_load_n(&from->latencyMax, __ATOMIC_RELAXED);
+			if (latencyMax > to->latencyMax) to->latencyMax = latencyMax;
+		}
+	}
+	for (i = 0; i < RECV_TABLE_SIZE; ++i) {
+		to = &recvMerged[i];
+		if (to->key == 0 || to->step == 0) continue;
+		expected = (to->lastTime - to->firstTime + to->step / 2) / to->step + 1;
+		to->lost = expected > to->packets ? expected - to->packets : 0;
+	}
+	return streams;
+}
+
+//--------------------------------------------------
+// Prints the merged totals, and the streams with the most losses if detailed
+void recvReport(uint64_t *lastPackets, uint64_t elapsed, int detailed) {
+	uint64_t packets = 0, bytes = 0, malformed = 0, untracked = 0, lost = 0, reordered = 0, counted = 0;
+	int64_t latencySum = 0, latencyMax = 0;
+	struct recvStream *s, *worst;
+	int i, t, w, streams;
+
+	for (t = 0; t < recvThreads; ++t) {
+		packets += __atomic_load_n(&recvState[t].counters.packets, __ATOMIC_RELAXED);
+		bytes += __atomic_load_n(&recvState[t].counters.bytes, __ATOMIC_RELAXED);
+		malformed += __atomic_load_n(&recvState[t].counters.malformed, __ATOMIC_RELAXED);
+		untracked += __atomic_load_n(&recvState[t].counters.untracked, __ATOMIC_RELAXED);
+	}
+	streams = recvMerge(&untracked);
+	for (i = 0; i < RECV_TABLE_SIZE; ++i) {
+		s = &recvMerged[i];
+		if (s->key == 0) continue;
+		lost += s->lost;
+		reordered += s->reordered;
+		latencySum += s->latencySum;
+		counted += s->packets;
+		if (s->latencyMax > latencyMax) latencyMax = s->latencyMax;
+	}
+	printf("Received: %llu (%.0f/s), %.1f MB, %d streams, lost: %llu, reordered: %llu, malformed: %llu, untracked: %llu",
+			(unsigned long long)packets, (packets - *lastPackets) * 1e9 / elapsed, bytes / 1e6, streams,
+			(unsigned long long)lost, (unsigned long long)reordered, (unsigned long long)malformed,
+			(unsigned long long)untracked);
+	if (counted > 0) printf(", latency avg %.1f us, max %lld us", (double)latencySum / counted, (long long)latencyMax);
+	printf("\n");
+	*lastPackets = packets;
+
+	for (w = 0; detailed && w < RECV_WORST; ++w) {
+		worst = NULL;
+		for (i = 0; i < RECV_TABLE_SIZE; ++i) {
+			s = &recvMerged[i];
+			if (s->key != 0 && s->lost > 0 && (worst == NULL || s->lost > worst->lost)) worst = s;
+		}
+		if (worst == NULL) break;
+		printf("  %s / %s on port %d: %llu packets, %llu lost, %llu reordered\n", worst->mission, worst->platform,
+				worst->port, (unsigned long long)worst->packets, (unsigned long long)worst->lost,
+				(unsigned long long)worst->reordered);
+		worst->lost = 0; // Listed, the next search skips it
+	}
+	fflush(stdout);
+}
+
+//--------------------------------------------------
+// Receives on servPort and the ports after it until interrupted
+int recvRun(void) {
+	uint64_t begin, next, last, lastPackets = 0;
+	int i, ports = coordStreams > 0 ? coordStreams : 1;
+
+	recvMerged = calloc(RECV_TABLE_SIZE, sizeof(*recvMerged));
+	if (recvMerged == NULL) {
+		printf("ERROR: Unable to allocate receiver tables\n");
+		return -1;
+	}
+	for (i = 0; i < recvThreads; ++i) {
+		recvState[i].index = i;
+		recvState[i].table = calloc(RECV_TABLE_SIZE, sizeof(struct recvStream));
+		recvState[i].epoll = epoll_create1(0);
+		if (recvState[i].table == NULL || recvState[i].epoll < 0) {
+			printf("ERROR: Unable to allocate receiver tables\n");
+			return -1;
+		}
+	}
+	for (i = 0; i < ports; ++i) {
+		if (recvOpenPort(servPort + i) == -1) return -1;
+	}
+	if (stateName[0] != '\0' && stateOpen(1) == -1) return -1;
+
+	signal(SIGINT, recvHandleSignal);
+	signal(SIGTERM, recvHandleSignal);
+	signal(SIGHUP, recvHandleSignal);
+	printf("Receiving on ports %d-%d with %d threads%s\n", servPort, servPort + ports - 1, recvThreads,
+			recvSteer ? ", steered by CPU" : "");
+	fflush(stdout);
+	for (i = 0; i < recvThreads; ++i) {
+		if (pthread_create(&recvState[i].thread, NULL, recvThreadRun, &recvState[i]) != 0) {
+			printf("ERROR: Unable to start receiver thread\n");
+			recvStop = 1;
+			while (--i >= 0) pthread_join(recvState[i].thread, NULL);
+			return -1;
+		}
+	}
+
+	begin = last = monotonicNanoseconds();
+	while (!recvStop) {
+		next = last + RECV_REPORT_INTERVAL;
+		while (!recvStop && monotonicNanoseconds() < next) usleep(10000);
+		if (recvStop) break;
+		recvReport(&lastPackets, next - last, 0);
+		last = next;
+	}
+	for (i = 0; i < recvThreads; ++i) pthread_join(recvState[i].thread, NULL);
+
+	printf("Final report after %.1f seconds:\n", (monotonicNanoseconds() - begin) / 1e9);
+	lastPackets = 0;
+	recvReport(&lastPackets, monotonicNanoseconds() - begin, 1);
+	return 0;
+}
+#endif
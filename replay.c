@@ -0,0 +1,280 @@
+//============================================================================
+//		KLV capture replay
+// Replays a captured file to the configured destination:
+// Raw .klv: concatenated packets, found with the key scanner; timing comes
+//   from each packet's embedded timestamp (tag 2)
+// pcap: UDP payloads of IPv4 packets on Ethernet, Linux cooked, raw IP or
+//   loopback captures; timing comes from the capture timestamps
+//
+// Packets keep their original spacing divided by the speed factor, a speed
+// of 0 sends as fast as possible, and a bit rate (-B) sends them at that
+// rate on the wire instead. Timestamps can be rewritten to the current time,
+// which recomputes each packet's checksum.
+//
+// The file is mmap'd and read sequentially, packets are sent in batches
+// straight from the mapping unless they are rewritten, so captures of any
+// size replay without being loaded into memory. -o and -u replay a range
+// of time, seeking to its start with the capture's index (index.c).
+//
+// Example usage: ./klvgen -f capture.pcap -s 10 -w -a 127.0.0.1 -p 9000
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PCAP_MAGIC 0xA1B2C3D4
+#define PCAP_MAGIC_NANOSECOND 0xA1B23C4D
+#define PCAP_LINK_NULL 0
+#define PCAP_LINK_ETHERNET 1
+#define PCAP_LINK_RAW 101
+#define PCAP_LINK_LINUX_SLL 113
+#define PCAP_LINK_LINUX_SLL2 276
+
+//============================================================================
+
+char replayFile[256];
+double replaySpeed = 1.0; // 0 = as fast as possible
+int replayRewrite;
+
+const unsigned char *replayMap;
+size_t replaySize;
+size_t replayPos;
+size_t replayRecord; // Start of the last packet (its pcap record), for the index
+int replayIsPcap;
+int replaySwapped; // pcap written on a host of the other byte order
+int replayNanosecond;
+uint32_t replayLinkType;
+uint64_t replayLastTime;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Reads a 32-bit pcap header field in the file's byte order
+uint32_t replayReadUint32(const unsigned char *buff) {
+	uint32_t value;
+	memcpy(&value, buff, 4);
+	return replaySwapped ? __builtin_bswap32(value) : value;
+}
+
+//--------------------------------------------------
+// Maps the replay file and detects its format, returns -1 on failure
+int replayOpen(void) {
+	struct stat st;
+	uint32_t magic;
+	int fd = open(replayFile, O_RDONLY);
+	if (fd < 0) {
+		perror("Unable to open replay file");
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		printf("ERROR: Replay file %s is empty\n", replayFile);
+		close(fd);
+		return -1;
+	}
+	replaySize = st.st_size;
+	replayMap = mmap(NULL, replaySize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (replayMap == MAP_FAILED) {
+		perror("Unable to map replay file");
+		return -1;
+	}
+	madvise((void *)replayMap, replaySize, MADV_SEQUENTIAL);
+
+	replayPos = 0;
+	if (replaySize >= 24) {
+		memcpy(&magic, replayMap, 4);
+		replaySwapped = (magic == __builtin_bswap32(PCAP_MAGIC) || magic == __builtin_bswap32(PCAP_MAGIC_NANOSECOND));
+		magic = replayReadUint32(replayMap);
+		if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NANOSECOND) {
+			replayIsPcap = 1;
+			replayNanosecond = (magic == PCAP_MAGIC_NANOSECOND);
+			replayLinkType = replayReadUint32(&replayMap[20]) & 0xFFFF;
+			replayPos = 24;
+		}
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Finds the UDP payload of a captured frame, returns its length or -1 if the
+// frame isn't an unfragmented IPv4 UDP packet
+int replayUdpPayload(const unsigned char *frame, uint32_t len, const unsigned char **payload) {
+	uint32_t ip, ipHeader;
+	uint16_t etherType;
+
+	switch (replayLinkType) {
+		case PCAP_LINK_ETHERNET:
+			if (len < 14) return -1;
+			ip = 14;
+			etherType = (frame[12] << 8) | frame[13];
+			if (etherType == 0x8100 && len >= 18) { // 802.1Q
+				etherType = (frame[16] << 8) | frame[17];
+				ip = 18;
+			}
+			if (etherType != 0x0800) return -1;
+			break;
+		case PCAP_LINK_LINUX_SLL:
+			if (len < 16 || frame[14] != 0x08 || frame[15] != 0x00) return -1;
+			ip = 16;
+			break;
+		case PCAP_LINK_LINUX_SLL2:
+			if (len < 20 || frame[0] != 0x08 || frame[1] != 0x00) return -1;
+			ip = 20;
+			break;
+		case PCAP_LINK_NULL:
+			ip = 4;
+			break;
+		case PCAP_LINK_RAW:
+			ip = 0;
+			break;
+		default:
+			return -1;
+	}
+	if (ip + 20 > len || (frame[ip] >> 4) != 4 || frame[ip + 9] != IPPROTO_UDP) return -1;
+	if (((frame[ip + 6] << 8) | frame[ip + 7]) & 0x3FFF) return -1; // Fragment
+	ipHeader = (frame[ip] & 0x0F) * 4;
+	if (ip + ipHeader + 8 > len) return -1;
+	*payload = &frame[ip + ipHeader + 8];
+	return len - ip - ipHeader - 8;
+}
+
+//--------------------------------------------------
+// Finds the next valid packet in the file and its capture time in
+// microseconds. Returns 1, or 0 at the end of the file.
+int replayNext(struct klvPacket *pkt, uint64_t *time) {
+	const unsigned char *payload;
+	uint32_t captured, seconds, fraction;
+	int len;
+
+	while (replayPos < replaySize) {
+		if (replayIsPcap) {
+			replayRecord = replayPos;
+			if (replayPos + 16 > replaySize) return 0;
+			seconds = replayReadUint32(&replayMap[replayPos]);
+			fraction = replayReadUint32(&replayMap[replayPos + 4]);
+			captured = replayReadUint32(&replayMap[replayPos + 8]);
+			if (replayPos + 16 + captured > replaySize) return 0;
+			len = replayUdpPayload(&replayMap[replayPos + 16], captured, &payload);
+			replayPos += 16 + captured;
+			if (len <= 0 || klvDecode(payload, len, pkt) <= 0) continue;
+			*time = (uint64_t)seconds * 1000000 + (replayNanosecond ? fraction / 1000 : fraction);
+			return 1;
+		}
+		replayPos += klvFindKey(&replayMap[replayPos], replaySize - replayPos);
+		if (replayPos >= replaySize) return 0;
+		len = klvDecode(&replayMap[replayPos], replaySize - replayPos, pkt);
+		if (len <= 0) {
+			replayPos++;
+			continue;
+		}
+		replayRecord = replayPos;
+		replayPos += len;
+		// Packets without a timestamp go out with the one before them
+		if (pkt->timestampView >= 0) replayLastTime = klvTimestamp(pkt);
+		*time = replayLastTime;
+		return 1;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Copies a packet into a pool slot with its timestamp replaced, and its
+// checksum recomputed
+void replayRewritePacket(const struct klvPacket *pkt, unsigned char *slot, uint64_t time) {
+	uint64_t netTime = htonll(time);
+	uint16_t netChecksum;
+	memcpy(slot, pkt->buff, pkt->length);
+	if (pkt->timestampView < 0) return;
+	memcpy(&slot[pkt->views[pkt->timestampView].offset], &netTime, 8);
+	netChecksum = htons(makeChecksum(slot, pkt->length - 2));
+	memcpy(&slot[pkt->length - 2], &netChecksum, 2);
+}
+
+//--------------------------------------------------
+// Sends a batch, at a bit rate once the bucket covers its size on the wire
+int replaySendBatch(struct byteBucket *bucket, unsigned char **batch, int *lengths, int count) {
+	uint64_t bytes = 0;
+	int i;
+	if (bitRate > 0) {
+		for (i = 0; i < count; ++i) bytes += wireBytes(lengths[i]);
+		byteBucketTake(bucket, bytes);
+	}
+	return udpSendBatch(batch, lengths, count);
+}
+
+//--------------------------------------------------
+// Replays the whole file, returns -1 on error
+int replayRun(void) {
+	unsigned char *batch[PACKET_BATCH_MAX];
+	int lengths[PACKET_BATCH_MAX];
+	unsigned char *slots;
+	struct klvPacket pkt;
+	uint64_t captureTime, firstCapture = 0, startClock = 0, startTime = 0, deadline;
+	uint64_t sent = 0, elapsed, batchBytes = 0, burstBytes = bitRate * BITRATE_BURST / 1000000000 / 8;
+	double speed = bitRate > 0 ? 0 : replaySpeed; // A bit rate replaces the capture timing
+	struct byteBucket bucket;
+	int count = 0, pending;
+
+	if (replayOpen() == -1) return -1;
+	printf("Replaying %s (%s, %llu bytes)\n", replayFile, replayIsPcap ? "pcap" : "raw KLV",
+			(unsigned long long)replaySize);
+	if ((indexFrom[0] != '\0' || indexUntil[0] != '\0') && klvIndexReplayRange() == -1) return -1;
+	slots = malloc((size_t)PACKET_BATCH_MAX * PACKET_MAX);
+	if (slots == NULL) {
+		printf("ERROR: Unable to allocate replay buffers\n");
+		return -1;
+	}
+
+	pending = klvIndexRangeNext(&pkt, &captureTime);
+	if (pending) {
+		firstCapture = captureTime;
+		startClock = streamStartTime(0);
+		sleepUntil(startClock);
+		startTime = updateTimestamp();
+		if (bitRate > 0) byteBucketStart(&bucket, startClock, burstBytes);
+	}
+	while (pending) {
+		// Offset from the first packet, scaled by the replay speed
+		if (captureTime < firstCapture) captureTime = firstCapture;
+		if (speed > 0) {
+			deadline = startClock + (uint64_t)((captureTime - firstCapture) * 1000 / speed);
+			if (deadline > monotonicNanoseconds()) {
+				// Send what is due before waiting for this packet
+				if (count > 0 && replaySendBatch(&bucket, batch, lengths, count) == -1) return -1;
+				sent += count;
+				count = 0;
+				sleepUntil(deadline);
+			}
+		}
+		if (replayRewrite) {
+			batch[count] = &slots[(size_t)count * PACKET_MAX];
+			replayRewritePacket(&pkt, batch[count], speed > 0 ?
+					startTime + (uint64_t)((captureTime - firstCapture) / speed) : updateTimestamp());
+		}
+		else batch[count] = (unsigned char *)pkt.buff;
+		lengths[count++] = pkt.length;
+		batchBytes += wireBytes(pkt.length);
+		// At a bit rate, batches are kept to about BITRATE_BURST of traffic
+		if (count == sendBatch || (bitRate > 0 && batchBytes >= burstBytes)) {
+			if (replaySendBatch(&bucket, batch, lengths, count) == -1) return -1;
+			sent += count;
+			count = 0;
+			batchBytes = 0;
+		}
+		pending = klvIndexRangeNext(&pkt, &captureTime);
+	}
+	if (count > 0 && replaySendBatch(&bucket, batch, lengths, count) == -1) return -1;
+	sent += count;
+
+	elapsed = sent > 0 ? monotonicNanoseconds() - startClock : 0;
+	printf("Replayed %llu packets in %.3f seconds\n", (unsigned long long)sent, elapsed / 1e9);
+	munmap((void *)replayMap, replaySize);
+	free(slots);
+	return 0;
+}
+#endif
@@ -0,0 +1,126 @@
+//============================================================================
+//		KLV stream scanner
+// Finds packets in unframed byte streams (TCP, files, transport stream
+// payloads) by searching for the 16-byte UAS LDS key. Candidates are found
+// 16 bytes at a time by comparing the first three key bytes with SSE2, then
+// confirmed against the whole key and validated by klvDecode(), so a
+// corrupted or truncated packet costs one skipped byte and the scanner
+// resynchronizes on the next key.
+//
+// Typical use, reading from fd:
+//   space = klvScannerSpace(&scanner, &room);
+//   klvScannerCommit(&scanner, read(fd, space, room));
+//   while (klvScannerNext(&scanner, &pkt) == 1) ...
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#define KLV_SCAN_BUFFER (4 * PACKET_MAX)
+
+//============================================================================
+
+// Streaming buffer, bytes between start and end are not yet consumed
+struct klvScanner {
+	unsigned char *buff;
+	size_t capacity;
+	size_t start;
+	size_t end;
+	uint64_t packets;
+	uint64_t skippedBytes; // Bytes discarded while resynchronizing
+	uint64_t rejected; // Key matches that failed length or checksum checks
+};
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Returns the offset of the first possible key in buff. A match at the end
+// that is cut short by len is returned as well, so the caller can wait for
+// more data. Returns len if there is none.
+size_t klvFindKey(const unsigned char *buff, size_t len) {
+	size_t i = 0, j;
+#ifdef __SSE2__
+	const __m128i k0 = _mm_set1_epi8(uasLdsKey[0]);
+	const __m128i k1 = _mm_set1_epi8(uasLdsKey[1]);
+	const __m128i k2 = _mm_set1_epi8(uasLdsKey[2]);
+	for (; i + 18 <= len; i += 16) {
+		__m128i match = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buff[i]), k0),
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buff[i + 1]), k1));
+		unsigned int bits;
+		match = _mm_and_si128(match, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buff[i + 2]), k2));
+		bits = _mm_movemask_epi8(match);
+		while (bits != 0) {
+			j = i + __builtin_ctz(bits);
+			if (memcmp(&buff[j], uasLdsKey, len - j < 16 ? len - j : 16) == 0) return j;
+			bits &= bits - 1;
+		}
+	}
+#endif
+	for (; i < len; ++i) {
+		if (buff[i] == uasLdsKey[0] && memcmp(&buff[i], uasLdsKey, len - i < 16 ? len - i : 16) == 0) return i;
+	}
+	return len;
+}
+
+//--------------------------------------------------
+// Allocates the scanner's buffer, returns -1 on failure
+int klvScannerInit(struct klvScanner *scanner) {
+	memset(scanner, 0, sizeof(*scanner));
+	scanner->capacity = KLV_SCAN_BUFFER;
+	scanner->buff = malloc(scanner->capacity);
+	if (scanner->buff == NULL) {
+		printf("ERROR: Unable to allocate scanner buffer\n");
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Returns where new stream data should be written and how much fits,
+// moving unconsumed bytes to the front of the buffer first
+unsigned char *klvScannerSpace(struct klvScanner *scanner, size_t *room) {
+	if (scanner->start > 0) {
+		memmove(scanner->buff, &scanner->buff[scanner->start], scanner->end - scanner->start);
+		scanner->end -= scanner->start;
+		scanner->start = 0;
+	}
+	*room = scanner->capacity - scanner->end;
+	return &scanner->buff[scanner->end];
+}
+
+//--------------------------------------------------
+// Marks len bytes written at klvScannerSpace() as part of the stream
+void klvScannerCommit(struct klvScanner *scanner, size_t len) {
+	scanner->end += len;
+}
+
+//--------------------------------------------------
+// Finds the next valid packet. Returns 1 with pkt viewing into the scanner
+// buffer (valid until the next klvScannerSpace call), or 0 if more data is needed.
+int klvScannerNext(struct klvScanner *scanner, struct klvPacket *pkt) {
+	size_t available, offset;
+	int result;
+
+	while (scanner->start < scanner->end) {
+		available = scanner->end - scanner->start;
+		offset = klvFindKey(&scanner->buff[scanner->start], available);
+		scanner->start += offset;
+		scanner->skippedBytes += offset;
+		available -= offset;
+		if (available == 0) return 0;
+
+		result = klvDecode(&scanner->buff[scanner->start], available, pkt);
+		if (result > 0) {
+			scanner->start += result;
+			scanner->packets++;
+			return 1;
+		}
+		// A packet can't be longer than the buffer, so a full buffer that is
+		// still short means the length is corrupt
+		if (result == KLV_DECODE_SHORT && available < scanner->capacity) return 0;
+		scanner->start++;
+		scanner->skippedBytes++;
+		scanner->rejected++;
+	}
+	return 0;
+}
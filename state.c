@@ -0,0 +1,245 @@
+//============================================================================
+//		Last-known state table
+// Keeps every received platform's latest decoded state in POSIX shared
+// memory, so displays can poll where the whole fleet is without talking to
+// the receiver (Linux only). -Z <name>[:capacity] with -l makes the
+// receiver threads write it; -Z <name> alone prints a snapshot of it, as an
+// example reader.
+//
+// The segment is a struct stateHeader followed by capacity entries (a power
+// of 2, default STATE_CAPACITY), placed by open addressing on the receiver's
+// stream key. An entry holds the stream's names, embedded timestamp,
+// arrival time, position and the raw local set items of its latest packet
+// (tag 2 up to the checksum, cut at an item boundary to STATE_PAYLOAD_MAX),
+// for readers that want other tags. The segment outlives the receiver, so
+// readers keep the final state; the next receiver with the name clears it.
+//
+// Each entry has its own sequence lock. A writer makes sequence odd, copies
+// the packet's state in, and makes it even again; a reader copies the entry
+// and retries if sequence was odd or moved meanwhile. Readers never write
+// the segment, so an update costs the same whatever the number of readers,
+// and a reader never waits for more than one update. Writers of one entry
+// (two receiver threads with packets of the same platform) take turns on
+// the odd sequence.
+//
+// Example usage: ./klvgen -l 4 -p 9000 -Z /klvstate, then ./klvgen -Z /klvstate
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifdef __gnu_linux__
+#define STATE_MAGIC 0x4B4C565354415445ULL // "KLVSTATE"
+#define STATE_VERSION 1
+#define STATE_CAPACITY 16384
+#define STATE_NAME_MAX 32
+#define STATE_PAYLOAD_MAX 448
+
+//============================================================================
+
+// Start of the segment
+struct stateHeader {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t entrySize;
+	uint32_t platforms; // Entries in use
+} __attribute__((aligned(64)));
+
+// One platform, key is set once when the entry is claimed, the rest is
+// covered by sequence
+struct stateEntry {
+	uint32_t sequence; // Odd while a writer is updating
+	uint16_t port;
+	uint16_t payloadLength;
+	uint64_t key; // 0 = free
+	char mission[STATE_NAME_MAX];
+	char platform[STATE_NAME_MAX];
+	uint64_t timestamp; // Embedded, UNIX microseconds
+	uint64_t received; // Arrival, UNIX microseconds
+	uint64_t packets;
+	double latitude; // Degrees, NaN if absent
+	double longitude;
+	double altitude; // Meters, NaN if absent
+	unsigned char payload[STATE_PAYLOAD_MAX];
+} __attribute__((aligned(64)));
+
+char stateName[64]; // Empty = no table
+uint32_t stateCapacity = STATE_CAPACITY;
+size_t stateSize;
+struct stateHeader *stateTable;
+struct stateEntry *stateEntries;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Parses <name>[:capacity], returns -1 if malformed
+int parseState(const char *str) {
+	const char *colon = strchr(str, ':');
+	size_t len = colon != NULL ? (size_t)(colon - str) : strlen(str);
+
+	if (len == 0 || len >= sizeof(stateName)) return -1;
+	memcpy(stateName, str, len);
+	stateName[len] = '\0';
+	if (colon != NULL) {
+		stateCapacity = strtoul(&colon[1], NULL, 10);
+		if (stateCapacity < 1 || (stateCapacity & (stateCapacity - 1)) != 0) return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Creates the segment for writing, or maps an existing one for reading.
+// Returns -1 if it can't be opened or isn't a state table.
+int stateOpen(int writer) {
+	struct stateHeader header;
+	int fd;
+
+	fd = shm_open(stateName, writer ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+	if (fd < 0) {
+		perror("Unable to open state table");
+		return -1;
+	}
+	if (writer) {
+		stateSize = sizeof(struct stateHeader) + (size_t)stateCapacity * sizeof(struct stateEntry);
+		if (ftruncate(fd, stateSize) != 0) {
+			perror("Unable to size state table");
+			close(fd);
+			return -1;
+		}
+	}
+	else {
+		if (read(fd, &header, sizeof(header)) != sizeof(header) || header.magic != STATE_MAGIC ||
+				header.version != STATE_VERSION || header.entrySize != sizeof(struct stateEntry)) {
+			printf("ERROR: %s is not a state table of this version\n", stateName);
+			close(fd);
+			return -1;
+		}
+		stateCapacity = header.capacity;
+		stateSize = sizeof(struct stateHeader) + (size_t)stateCapacity * sizeof(struct stateEntry);
+	}
+	stateTable = mmap(NULL, stateSize, writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (stateTable == MAP_FAILED) {
+		perror("Unable to map state table");
+		stateTable = NULL;
+		return -1;
+	}
+	stateEntries = (struct stateEntry *)&stateTable[1];
+	if (writer) {
+		// A new segment reads as zeros, every entry free
+		stateTable->version = STATE_VERSION;
+		stateTable->capacity = stateCapacity;
+		stateTable->entrySize = sizeof(struct stateEntry);
+		__atomic_store_n(&stateTable->magic, STATE_MAGIC, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Finds or claims a platform's entry, NULL if the table is full
+struct stateEntry *stateClaim(uint64_t key) {
+	uint32_t i = (uint32_t)(key ^ (key >> 32)) & (stateCapacity - 1);
+	uint32_t probes;
+	uint64_t found;
+
+	for (probes = 0; probes < stateCapacity; ++probes) {
+		found = __atomic_load_n(&stateEntries[i].key, __ATOMIC_ACQUIRE);
+		if (found == key) return &stateEntries[i];
+		if (found == 0) {
+			if (__atomic_compare_exchange_n(&stateEntries[i].key, &found, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				__atomic_add_fetch(&stateTable->platforms, 1, __ATOMIC_RELAXED);
+				return &stateEntries[i];
+			}
+			if (found == key) return &stateEntries[i]; // Another thread claimed it first
+		}
+		i = (i + 1) & (stateCapacity - 1);
+	}
+	return NULL;
+}
+
+//--------------------------------------------------
+// Copies a name view into an entry, NUL terminated
+void stateCopyName(char *name, const struct klvPacket *pkt, const struct klvView *view) {
+	uint32_t length = 0;
+	if (view != NULL) {
+		length = view->length < STATE_NAME_MAX - 1 ? view->length : STATE_NAME_MAX - 1;
+		memcpy(name, &pkt->buff[view->offset], length);
+	}
+	memset(&name[length], 0, STATE_NAME_MAX - length);
+}
+
+//--------------------------------------------------
+// Writes a decoded packet as its platform's latest state, called by the
+// receiver threads. Returns -1 if the table is full.
+int stateUpdate(uint64_t key, const struct klvPacket *pkt, const struct klvView *mission,
+		const struct klvView *platform, uint16_t port, uint64_t now) {
+	struct stateEntry *e = stateClaim(key);
+	uint32_t sequence, start, end;
+	int i;
+
+	if (e == NULL) return -1;
+	// Items start after the key and BER length, the checksum item isn't kept
+	start = 17 + ((pkt->buff[16] & 0x80) ? (pkt->buff[16] & 0x7F) : 0);
+	for (end = start, i = 0; i < pkt->count - 1; ++i) {
+		if (pkt->views[i].offset + pkt->views[i].length - start > STATE_PAYLOAD_MAX) break;
+		end = pkt->views[i].offset + pkt->views[i].length;
+	}
+
+	do {
+		sequence = __atomic_load_n(&e->sequence, __ATOMIC_RELAXED) & ~1U;
+	} while (!__atomic_compare_exchange_n(&e->sequence, &sequence, sequence + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if (e->packets == 0) {
+		e->port = port;
+		stateCopyName(e->mission, pkt, mission);
+		stateCopyName(e->platform, pkt, platform);
+	}
+	e->timestamp = klvTimestamp(pkt);
+	e->received = now;
+	e->packets++;
+	e->latitude = klvLatitude(pkt);
+	e->longitude = klvLongitude(pkt);
+	e->altitude = klvAltitude(pkt);
+	e->payloadLength = end - start;
+	memcpy(e->payload, &pkt->buff[start], end - start);
+	__atomic_store_n(&e->sequence, sequence + 2, __ATOMIC_RELEASE);
+	return 0;
+}
+
+//--------------------------------------------------
+// Copies a consistent snapshot of an entry, retrying while it is written
+void stateRead(const struct stateEntry *e, struct stateEntry *copy) {
+	uint32_t before, after;
+	do {
+		before = __atomic_load_n(&e->sequence, __ATOMIC_ACQUIRE);
+		memcpy(copy, e, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&e->sequence, __ATOMIC_RELAXED);
+	} while ((before & 1) || before != after);
+}
+
+//--------------------------------------------------
+// Reader example: prints every platform in the table once
+int stateDump(void) {
+	struct stateEntry copy;
+	struct timespec ts;
+	uint64_t now;
+	uint32_t i;
+
+	if (stateOpen(0) == -1) return -1;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	printf("%u platforms in %s\n", __atomic_load_n(&stateTable->platforms, __ATOMIC_RELAXED), stateName);
+	for (i = 0; i < stateCapacity; ++i) {
+		if (__atomic_load_n(&stateEntries[i].key, __ATOMIC_ACQUIRE) == 0) continue;
+		stateRead(&stateEntries[i], &copy);
+		if (copy.packets == 0) continue;
+		printf("  %s / %s on port %d: %.6f %.6f %.1f m, stamped %.3f s ago, %llu packets, %d item bytes\n",
+				copy.mission, copy.platform, copy.port, copy.latitude, copy.longitude, copy.altitude,
+				((int64_t)now - (int64_t)copy.timestamp) / 1e6, (unsigned long long)copy.packets, copy.payloadLength);
+	}
+	munmap(stateTable, stateSize);
+	return 0;
+}
+#endif
@@ -0,0 +1,254 @@
+//============================================================================
+//		Transmit timestamping
+// Measures when packets actually leave, with SO_TIMESTAMPING transmit
+// timestamps on the UDP socket (Linux only):
+// sw: the kernel stamps each packet as it is handed to the device driver
+// hw:<interface>: the NIC also stamps it on the wire, if the interface
+//   supports it. Hardware stamps come from the NIC clock, so they are only
+//   comparable with the system clock when that is synchronized (phc2sys).
+//
+// Every packet sent is numbered by the kernel (SOF_TIMESTAMPING_OPT_ID) in
+// send order, so udpSendPacket() and udpSendBatchTo() record each packet's
+// scheduled time and embedded KLV timestamp in a ring under the same number.
+// A GSO send (-U gso) is one packet to the kernel, recorded and stamped as
+// its first datagram.
+// The stamps are read back from the socket error queue in batches, once
+// TXSTAMP_BATCH packets were sent since the last read and at each report, so
+// the paced loop doesn't pay a read per packet. They are matched to the ring,
+// feeding three latency histograms:
+// schedule to stamp: pacer deadline to the KLV timestamp, userspace wakeup
+// stamp to wire: KLV timestamp to the kernel transmit stamp, packet
+//   building, the send call and the qdisc
+// wire to NIC: software to hardware stamp, the driver and NIC queue
+// They are reported every TXSTAMP_REPORT_INTERVAL and at exit. Packets
+// without a generated layout (replay) or a pacer deadline (flood) skip the
+// stages they have no time for. The embedded timestamp has to be host time,
+// so clock models (-K) can't be used with it.
+//
+// Example usage: ./klvgen -S sw -r 1000 -a 127.0.0.1 -p 9000
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifdef __gnu_linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+
+#define TXSTAMP_RING 65536 // Packets awaiting their stamps, a power of 2
+#define TXSTAMP_BUCKETS 24 // Powers of 2 microseconds
+#define TXSTAMP_BATCH 64 // Error queue messages read per call
+#define TXSTAMP_CONTROL_MAX 256
+#define TXSTAMP_REPORT_INTERVAL 5000000000ULL
+
+//============================================================================
+
+// What was known about a packet when it was sent, realtime nanoseconds
+struct txstampRecord {
+	uint32_t id;
+	int stamped; // Software stamp seen
+	uint64_t scheduled; // 0 = unpaced
+	uint64_t embedded; // 0 = no KLV timestamp
+	uint64_t software; // Kernel transmit stamp
+};
+
+// Latency distribution of one stage, bucket i counts latencies under 2^i us
+struct txstampHistogram {
+	const char *name;
+	uint64_t count;
+	uint64_t sum; // Nanoseconds
+	uint64_t max;
+	uint64_t buckets[TXSTAMP_BUCKETS];
+};
+
+char txstampMode[32]; // "sw" or "hw:<interface>", empty = off
+int txstampActive;
+uint64_t txstampScheduled; // Monotonic deadline of the packets being sent, set by the pacing loop
+int64_t txstampClockOffset; // Realtime minus monotonic nanoseconds
+uint32_t txstampNextId; // Kernel number of the next packet sent
+uint32_t txstampReadId; // txstampNextId at the last error queue read
+struct txstampRecord txstampRing[TXSTAMP_RING];
+uint64_t txstampSentCount;
+uint64_t txstampSoftware;
+uint64_t txstampHardware;
+uint64_t txstampLastReport;
+struct txstampHistogram txstampScheduleToStamp = {"schedule to stamp"};
+struct txstampHistogram txstampStampToWire = {"stamp to wire"};
+struct txstampHistogram txstampWireToNic = {"wire to NIC"};
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Enables hardware transmit stamping on an interface, returns -1 if unsupported
+int txstampEnableHardware(const char *interface) {
+	struct hwtstamp_config config;
+	struct ifreq ifr;
+
+	memset(&config, 0, sizeof(config));
+	config.tx_type = HWTSTAMP_TX_ON;
+	config.rx_filter = HWTSTAMP_FILTER_NONE;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+	ifr.ifr_data = (void *)&config;
+	return ioctl(sock, SIOCSHWTSTAMP, &ifr) == 0 ? 0 : -1;
+}
+
+//--------------------------------------------------
+// Turns on transmit stamps for sock, call from udpInit()
+int txstampInit(void) {
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+			SOF_TIMESTAMPING_OPT_TSONLY;
+	struct timespec real, mono;
+
+	if (strncmp(txstampMode, "hw:", 3) == 0) {
+		if (txstampEnableHardware(&txstampMode[3]) == 0)
+			flags |= SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+		else printf("WARNING: No hardware timestamps on %s, using software only\n", &txstampMode[3]);
+	}
+	else if (strcmp(txstampMode, "sw") != 0) {
+		printf("ERROR: Unknown timestamp mode %s\n", txstampMode);
+		return -1;
+	}
+	if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+		perror("Unable to enable transmit timestamps");
+		return -1;
+	}
+	clock_gettime(CLOCK_REALTIME, &real);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	txstampClockOffset = ((int64_t)real.tv_sec - mono.tv_sec) * 1000000000 + (real.tv_nsec - mono.tv_nsec);
+	txstampNextId = txstampReadId = 0;
+	txstampLastReport = monotonicNanoseconds();
+	txstampActive = 1;
+	return 0;
+}
+
+//--------------------------------------------------
+// Adds a latency, negative ones (clock steps, unsynchronized NIC clocks) count as 0
+void txstampAdd(struct txstampHistogram *histogram, int64_t latency) {
+	uint64_t us;
+	int bucket = 0;
+
+	if (latency < 0) latency = 0;
+	histogram->count++;
+	histogram->sum += latency;
+	if ((uint64_t)latency > histogram->max) histogram->max = latency;
+	for (us = latency / 1000; us > 0 && bucket < TXSTAMP_BUCKETS - 1; us >>= 1) bucket++;
+	histogram->buckets[bucket]++;
+}
+
+//--------------------------------------------------
+// Prints one histogram on a line, only the buckets in use
+void txstampPrintHistogram(const struct txstampHistogram *histogram) {
+	int i;
+	if (histogram->count == 0) return;
+	printf("  %s: avg %.1f us, max %.1f us |", histogram->name, histogram->sum / 1e3 / histogram->count,
+			histogram->max / 1e3);
+	for (i = 0; i < TXSTAMP_BUCKETS; ++i) {
+		if (histogram->buckets[i] > 0) printf(" <%lluus %llu", 1ULL << i, (unsigned long long)histogram->buckets[i]);
+	}
+	printf("\n");
+}
+
+//--------------------------------------------------
+// Prints the stamp counts and histograms
+void txstampReport(void) {
+	printf("TX timestamps: %llu sent, %llu software, %llu hardware, %llu pending\n",
+			(unsigned long long)txstampSentCount, (unsigned long long)txstampSoftware,
+			(unsigned long long)txstampHardware, (unsigned long long)(txstampSentCount - txstampSoftware));
+	txstampPrintHistogram(&txstampScheduleToStamp);
+	txstampPrintHistogram(&txstampStampToWire);
+	txstampPrintHistogram(&txstampWireToNic);
+	fflush(stdout);
+}
+
+//--------------------------------------------------
+// Matches one stamp from the error queue to its packet
+void txstampMatch(uint32_t id, const struct scm_timestamping *stamps) {
+	struct txstampRecord *record = &txstampRing[id & (TXSTAMP_RING - 1)];
+	uint64_t software = (uint64_t)stamps->ts[0].tv_sec * 1000000000 + stamps->ts[0].tv_nsec;
+	uint64_t hardware = (uint64_t)stamps->ts[2].tv_sec * 1000000000 + stamps->ts[2].tv_nsec;
+
+	if (record->id != id) return; // Overwritten by a later packet
+	if (software != 0 && !record->stamped) {
+		record->stamped = 1;
+		record->software = software;
+		txstampSoftware++;
+		if (record->embedded != 0) txstampAdd(&txstampStampToWire, software - record->embedded);
+	}
+	// The hardware stamp arrives as its own message, usually after the software one
+	if (hardware != 0) {
+		txstampHardware++;
+		if (record->stamped) txstampAdd(&txstampWireToNic, hardware - record->software);
+	}
+}
+
+//--------------------------------------------------
+// Reads the stamps waiting on the error queue
+void txstampCollect(void) {
+	static char control[TXSTAMP_BATCH][TXSTAMP_CONTROL_MAX];
+	struct mmsghdr msgs[TXSTAMP_BATCH];
+	struct cmsghdr *cmsg;
+	struct sock_extended_err *err;
+	struct scm_timestamping *stamps;
+	int i, n;
+
+	do {
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < TXSTAMP_BATCH; ++i) {
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = TXSTAMP_CONTROL_MAX;
+		}
+		n = recvmmsg(sock, msgs, TXSTAMP_BATCH, MSG_ERRQUEUE | MSG_DONTWAIT, NULL);
+		for (i = 0; i < n; ++i) {
+			stamps = NULL;
+			err = NULL;
+			for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+					stamps = (struct scm_timestamping *)CMSG_DATA(cmsg);
+				else if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+					err = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			}
+			if (stamps != NULL && err != NULL && err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING &&
+					err->ee_info == SCM_TSTAMP_SND)
+				txstampMatch(err->ee_data, stamps);
+		}
+	} while (n == TXSTAMP_BATCH);
+	txstampReadId = txstampNextId;
+}
+
+//--------------------------------------------------
+// Records count packets just accepted by the kernel, in send order. lengths
+// is as for udpSendBatchTo(), packets of the generated layout carry a KLV
+// timestamp.
+void txstampSent(unsigned char **packets, const int *lengths, int count) {
+	struct txstampRecord *record;
+	uint64_t embedded, now;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		record = &txstampRing[txstampNextId & (TXSTAMP_RING - 1)];
+		record->id = txstampNextId++;
+		record->stamped = 0;
+		record->scheduled = txstampScheduled != 0 ? txstampScheduled + txstampClockOffset : 0;
+		record->embedded = 0;
+		if (lengths == NULL) {
+			memcpy(&embedded, &packets[i][timestampOffset], 8);
+			record->embedded = htonll(embedded) * 1000;
+		}
+		if (record->scheduled != 0 && record->embedded != 0)
+			txstampAdd(&txstampScheduleToStamp, record->embedded - record->scheduled);
+	}
+	txstampSentCount += count;
+
+	now = monotonicNanoseconds();
+	if (now - txstampLastReport >= TXSTAMP_REPORT_INTERVAL) {
+		txstampLastReport = now;
+		txstampCollect();
+		txstampReport();
+	}
+	else if (txstampNextId - txstampReadId >= TXSTAMP_BATCH) txstampCollect();
+}
+#endif
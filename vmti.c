@@ -0,0 +1,233 @@
+//============================================================================
+//		VMTI target list generator
+// Builds a MISB ST 0903 Video Moving Target Indicator local set, nested in
+// ST 0601 tag 74, with a configurable number of synthetic moving targets:
+// VMTI System Name: ASCII, "klvgen"
+// Version: 5, ST 0903.5
+// Total/Reported Targets: equal to the configured target count
+// Frame Number: counts packets sent
+// Frame Width/Height: 1920 x 1080 pixels
+// VTarget Series: one VTarget pack per target with centroid, bounding box,
+//   confidence, row, column and location (IMAPB lat/lon/HAE)
+//
+// Every value is encoded at a fixed width, so the set's layout depends only
+// on the target count. It is encoded once and per packet only the frame
+// number and target values are rewritten in place.
+// Targets drift across the frame at constant velocity, reflecting off the
+// frame edges. The frame is centered below the sensor, targets are on the
+// ellipsoid (HAE 0).
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#define VMTI_TARGET_MAX 1400 // Keeps the largest packet within one UDP datagram
+#define VMTI_FRAME_WIDTH 1920
+#define VMTI_FRAME_HEIGHT 1080
+#define VMTI_DEGREES_PER_PIXEL 0.00001
+
+//============================================================================
+
+int vmtiTargets = -1; // Number of targets per packet, -1 = no VMTI set
+unsigned char vmtiSet[4 + VMTI_TARGET_MAX * 44 + 64]; // Tag 74, BER length and value
+int vmtiSetLength;
+uint32_t vmtiTemplateSum; // Checksum contribution of vmtiSet at vmtiOffset
+uint32_t vmtiFrame;
+uint64_t vmtiEpoch; // Time of the first VMTI packet, motion starts from here
+
+const unsigned char vmtiTag = 0x4A;
+const char vmtiSystemName[] = "klvgen";
+const unsigned char vmtiVersion = 5;
+
+// Target location pack fields, ST 0903 IMAPB mappings
+struct imapbParams vmtiLatitudeMap;
+struct imapbParams vmtiLongitudeMap;
+struct imapbParams vmtiHaeMap;
+
+// Positions of the per-packet values within vmtiSet
+int vmtiFrameOffset;
+int vmtiTargetOffset[VMTI_TARGET_MAX];
+
+// Target motion, one entry per target
+int32_t vmtiX0[VMTI_TARGET_MAX];
+int32_t vmtiY0[VMTI_TARGET_MAX];
+int32_t vmtiVx[VMTI_TARGET_MAX]; // Pixels per second
+int32_t vmtiVy[VMTI_TARGET_MAX];
+int32_t vmtiHalfWidth[VMTI_TARGET_MAX];
+int32_t vmtiHalfHeight[VMTI_TARGET_MAX];
+unsigned char vmtiConfidence[VMTI_TARGET_MAX];
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Advances an xorshift32 generator, targets come out the same on every run
+uint32_t xorshift32(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+//--------------------------------------------------
+// Writes a fixed width big-endian unsigned value, returns the position after it
+int appendUint(unsigned char *buff, int pos, uint32_t value, int width) {
+	int i;
+	for (i = width - 1; i >= 0; --i, value >>= 8) buff[pos + i] = value & 0xFF;
+	return pos + width;
+}
+
+//--------------------------------------------------
+// Appends a tag and fixed width unsigned value, returns the position after them
+int appendUintItem(unsigned char *buff, int pos, unsigned char tag, uint32_t value, int width) {
+	buff[pos++] = tag;
+	buff[pos++] = width;
+	return appendUint(buff, pos, value, width);
+}
+
+//--------------------------------------------------
+// Writes a BER-OID value (target IDs), returns the position after it
+int appendBerOid(unsigned char *buff, int pos, uint32_t value) {
+	int bytes = 1, i;
+	while ((value >> (7 * bytes)) > 0) bytes++;
+	for (i = bytes - 1; i >= 0; --i)
+		buff[pos++] = ((value >> (7 * i)) & 0x7F) | (i > 0 ? 0x80 : 0);
+	return pos;
+}
+
+//--------------------------------------------------
+// Picks a starting position, velocity and size for every target
+void initVmtiTargets(void) {
+	uint32_t seed = 0x2545F491;
+	int i;
+	for (i = 0; i < vmtiTargets; ++i) {
+		xorshift32(&seed);
+		vmtiX0[i] = seed % VMTI_FRAME_WIDTH;
+		vmtiY0[i] = (seed >> 11) % VMTI_FRAME_HEIGHT;
+		xorshift32(&seed);
+		vmtiVx[i] = (int32_t)(seed % 401) - 200;
+		vmtiVy[i] = (int32_t)((seed >> 9) % 401) - 200;
+		vmtiHalfWidth[i] = 4 + (seed >> 18) % 28;
+		vmtiHalfHeight[i] = 4 + (seed >> 23) % 28;
+		vmtiConfidence[i] = 50 + (seed >> 27) % 51;
+	}
+}
+
+//--------------------------------------------------
+// Encode the VMTI set with every per-packet value zeroed. Only needs to run
+// again if the target count changes.
+void encodeVmtiSet(void) {
+	unsigned char *value = &vmtiSet[4]; // Room for tag 74 and a 3 byte BER length
+	unsigned char ber[4];
+	int len = 0, seriesStart, packStart, i, berLength;
+
+	vmtiSetLength = 0;
+	if (vmtiTargets < 0) return;
+	initVmtiTargets();
+	imapbInit(&vmtiLatitudeMap, -90, 90, 4);
+	imapbInit(&vmtiLongitudeMap, -180, 180, 4);
+	imapbInit(&vmtiHaeMap, -900, 19000, 2);
+
+	len = appendItem(value, len, 0x03, vmtiSystemName, strlen(vmtiSystemName));
+	len = appendItem(value, len, 0x04, &vmtiVersion, 1);
+	len = appendUintItem(value, len, 0x05, vmtiTargets, 2);
+	len = appendUintItem(value, len, 0x06, vmtiTargets, 2);
+	vmtiFrameOffset = len + 2;
+	len = appendUintItem(value, len, 0x07, 0, 4);
+	len = appendUintItem(value, len, 0x08, VMTI_FRAME_WIDTH, 2);
+	len = appendUintItem(value, len, 0x09, VMTI_FRAME_HEIGHT, 2);
+	if (vmtiTargets > 0) {
+		// VTarget Series: tag 101, 3 byte BER length, then length-prefixed VTarget packs
+		value[len] = 0x65;
+		seriesStart = len + 4;
+		len = seriesStart;
+		for (i = 0; i < vmtiTargets; ++i) {
+			packStart = len++;
+			len = appendBerOid(value, len, i + 1);
+			vmtiTargetOffset[i] = len;
+			len = appendUintItem(value, len, 0x01, 0, 4); // Centroid pixel number
+			len = appendUintItem(value, len, 0x02, 0, 4); // Bounding box top left
+			len = appendUintItem(value, len, 0x03, 0, 4); // Bounding box bottom right
+			len = appendUintItem(value, len, 0x05, 0, 1); // Confidence level
+			len = appendUintItem(value, len, 0x13, 0, 2); // Centroid row (tag 19)
+			len = appendUintItem(value, len, 0x14, 0, 2); // Centroid column (tag 20)
+			value[len++] = 0x11; // Target Location (tag 17): latitude, longitude, HAE
+			value[len++] = 10;
+			len = appendUint(value, len, 0, 8);
+			len = imapbWrite(&vmtiHaeMap, 0.0, value, len);
+			value[packStart] = len - packStart - 1;
+		}
+		value[seriesStart - 3] = 0x82;
+		appendUint(value, seriesStart - 2, len - seriesStart, 2);
+	}
+
+	// Move the value up against its tag and BER length
+	berLength = berEncodeLength(ber, len);
+	vmtiSet[0] = vmtiTag;
+	memcpy(&vmtiSet[1], ber, berLength);
+	memmove(&vmtiSet[1 + berLength], value, len);
+	vmtiFrameOffset += 1 + berLength;
+	for (i = 0; i < vmtiTargets; ++i) vmtiTargetOffset[i] += 1 + berLength;
+	vmtiSetLength = 1 + berLength + len;
+}
+
+//--------------------------------------------------
+// Reflects a position moving along 0..size-1 off both ends
+int32_t reflectPosition(int64_t pos, int32_t size) {
+	int64_t m = pos % (2 * size);
+	if (m < 0) m += 2 * size;
+	return (int32_t)(m < size ? m : 2 * size - 1 - m);
+}
+
+//--------------------------------------------------
+// Writes the frame number and target positions at the given time (microseconds)
+// into a packet's copy of the VMTI set, buff points at the tag 74 byte
+void updateVmtiSet(unsigned char *buff, uint64_t time) {
+	uint32_t centroid[VMTI_TARGET_MAX], topLeft[VMTI_TARGET_MAX], bottomRight[VMTI_TARGET_MAX];
+	uint16_t row[VMTI_TARGET_MAX], column[VMTI_TARGET_MAX];
+	double lat[VMTI_TARGET_MAX], lon[VMTI_TARGET_MAX];
+	uint32_t latMapped[VMTI_TARGET_MAX], lonMapped[VMTI_TARGET_MAX];
+	int64_t elapsed;
+	uint32_t frame;
+	int i;
+
+	if (vmtiEpoch == 0) vmtiEpoch = time;
+	elapsed = (int64_t)(time - vmtiEpoch);
+	frame = htonl(vmtiFrame++);
+	memcpy(&buff[vmtiFrameOffset], &frame, 4);
+
+	// Positions for all targets first, as plain array loops, then the writes
+	for (i = 0; i < vmtiTargets; ++i) {
+		int32_t x = reflectPosition(vmtiX0[i] + vmtiVx[i] * elapsed / 1000000, VMTI_FRAME_WIDTH);
+		int32_t y = reflectPosition(vmtiY0[i] + vmtiVy[i] * elapsed / 1000000, VMTI_FRAME_HEIGHT);
+		int32_t left = x - vmtiHalfWidth[i] < 0 ? 0 : x - vmtiHalfWidth[i];
+		int32_t top = y - vmtiHalfHeight[i] < 0 ? 0 : y - vmtiHalfHeight[i];
+		int32_t right = x + vmtiHalfWidth[i] >= VMTI_FRAME_WIDTH ? VMTI_FRAME_WIDTH - 1 : x + vmtiHalfWidth[i];
+		int32_t bottom = y + vmtiHalfHeight[i] >= VMTI_FRAME_HEIGHT ? VMTI_FRAME_HEIGHT - 1 : y + vmtiHalfHeight[i];
+		// Pixel numbers count from 1 across rows, per ST 0903
+		centroid[i] = y * VMTI_FRAME_WIDTH + x + 1;
+		topLeft[i] = top * VMTI_FRAME_WIDTH + left + 1;
+		bottomRight[i] = bottom * VMTI_FRAME_WIDTH + right + 1;
+		row[i] = htons(y + 1);
+		column[i] = htons(x + 1);
+		lat[i] = latitudeDegrees + (VMTI_FRAME_HEIGHT / 2 - y) * VMTI_DEGREES_PER_PIXEL;
+		lon[i] = longitudeDegrees + (x - VMTI_FRAME_WIDTH / 2) * VMTI_DEGREES_PER_PIXEL;
+	}
+	imapbEncodeArray(&vmtiLatitudeMap, lat, latMapped, vmtiTargets);
+	imapbEncodeArray(&vmtiLongitudeMap, lon, lonMapped, vmtiTargets);
+	htonlArray(centroid, centroid, vmtiTargets);
+	htonlArray(topLeft, topLeft, vmtiTargets);
+	htonlArray(bottomRight, bottomRight, vmtiTargets);
+	htonlArray(latMapped, latMapped, vmtiTargets);
+	htonlArray(lonMapped, lonMapped, vmtiTargets);
+	for (i = 0; i < vmtiTargets; ++i) {
+		unsigned char *target = &buff[vmtiTargetOffset[i]];
+		memcpy(&target[2], &centroid[i], 4);
+		memcpy(&target[8], &topLeft[i], 4);
+		memcpy(&target[14], &bottomRight[i], 4);
+		target[20] = vmtiConfidence[i];
+		memcpy(&target[23], &row[i], 2);
+		memcpy(&target[27], &column[i], 2);
+		memcpy(&target[31], &latMapped[i], 4);
+		memcpy(&target[35], &lonMapped[i], 4);
+	}
+}
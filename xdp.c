@@ -0,0 +1,358 @@
+//============================================================================
+//		AF_XDP transmit backend
+// Sends prebuilt Ethernet/IPv4/UDP/KLV frames out of an AF_XDP socket in copy
+// mode, so it works on any interface (including a veth pair) without driver
+// support for zero-copy.
+//
+// Every frame in the UMEM is written from a template once at startup. Per
+// packet the KLV payload is restamped by makePacketBatch and the UDP
+// checksum is updated from a precomputed partial sum.
+//
+// Example usage: ./klvgen -x veth0 -M 02:00:00:00:00:01 -a 10.0.0.2 -r 0
+//
+// Author: Kevan Ahlquist
+// All rights reserved
+//============================================================================
+
+#ifdef __gnu_linux__
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#ifndef AF_XDP
+#	define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#	define SOL_XDP 283
+#endif
+
+#define XDP_FRAME_SIZE 2048
+#define XDP_FRAME_COUNT 4096
+#define XDP_RING_SIZE 2048
+#define XDP_KICK_SIZE 32 // Descriptors the kernel sends per kick in copy mode
+#define XDP_UDP_OFFSET 34 // Ethernet (14) + IPv4 (20)
+#define XDP_KLV_OFFSET 42 // Ethernet (14) + IPv4 (20) + UDP (8)
+
+//============================================================================
+
+char xdpInterface[IFNAMSIZ];
+int xdpQueue;
+unsigned char xdpDstMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+unsigned char xdpSrcMac[6];
+uint32_t xdpSrcAddr;
+
+// Producer/consumer ring shared with the kernel
+struct xdpRing {
+	uint32_t *producer;
+	uint32_t *consumer;
+	void *descs;
+	uint32_t size;
+	uint32_t mask;
+};
+
+struct xdpRing xdpTx;
+struct xdpRing xdpFill;
+struct xdpRing xdpCompletion;
+unsigned char *xdpUmem;
+uint64_t xdpFreeFrames[XDP_FRAME_COUNT];
+uint32_t xdpFreeCount;
+
+uint32_t xdpUdpBase; // UDP checksum sum of the template with zero timestamp and KLV checksum
+uint64_t xdpPacketsSent;
+
+//============================================================================
+// FUNCTIONS
+//--------------------------------------------------
+// Folds a 32-bit sum into a 16-bit ones' complement checksum
+uint16_t foldChecksum(uint32_t sum) {
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+//--------------------------------------------------
+// Parses a MAC address in aa:bb:cc:dd:ee:ff notation
+int parseMac(const char *str, unsigned char *mac) {
+	unsigned int b[6];
+	int i;
+	if (sscanf(str, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) return -1;
+	for (i = 0; i < 6; ++i) {
+		if (b[i] > 0xFF) return -1;
+		mac[i] = (unsigned char)b[i];
+	}
+	return 0;
+}
+
+//--------------------------------------------------
+// Reads the hardware and IPv4 address of the XDP interface
+int xdpReadInterface(void) {
+	struct ifreq ifr;
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("Unable to create socket.");
+		return -1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, xdpInterface, IFNAMSIZ - 1);
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) == -1) {
+		perror("Unable to read interface hardware address");
+		close(fd);
+		return -1;
+	}
+	memcpy(xdpSrcMac, ifr.ifr_hwaddr.sa_data, 6);
+	if (ioctl(fd, SIOCGIFADDR, &ifr) == -1) {
+		printf("WARNING: %s has no IPv4 address, sending from 0.0.0.0\n", xdpInterface);
+		xdpSrcAddr = 0;
+	}
+	else xdpSrcAddr = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
+	close(fd);
+	return 0;
+}
+
+//--------------------------------------------------
+// Writes the Ethernet/IPv4/UDP/KLV template frame and the checksum base sums
+void xdpBuildTemplate(unsigned char *frame) {
+	struct iphdr ip;
+	struct udphdr udp;
+	uint16_t etherType = htons(ETH_P_IP);
+	uint16_t udpLength = sizeof(udp) + packetLength;
+	uint32_t dstAddr = inet_addr(address);
+
+	memcpy(&frame[0], xdpDstMac, 6);
+	memcpy(&frame[6], xdpSrcMac, 6);
+	memcpy(&frame[12], &etherType, 2);
+
+	memset(&ip, 0, sizeof(ip));
+	ip.version = 4;
+	ip.ihl = sizeof(ip) / 4;
+	ip.tot_len = htons(sizeof(ip) + udpLength);
+	ip.frag_off = htons(IP_DF);
+	ip.ttl = ttl;
+	ip.protocol = IPPROTO_UDP;
+	ip.saddr = xdpSrcAddr;
+	ip.daddr = dstAddr;
+	ip.check = htons(foldChecksum(sumBytesAt((unsigned char *)&ip, sizeof(ip), 0)));
+	memcpy(&frame[14], &ip, sizeof(ip));
+
+	memset(&udp, 0, sizeof(udp));
+	udp.source = htons(servPort);
+	udp.dest = htons(servPort);
+	udp.len = htons(udpLength);
+	memcpy(&frame[XDP_UDP_OFFSET], &udp, sizeof(udp));
+
+	// Timestamp and KLV checksum are zero in the template, they and the orbit
+	// and VMTI fields are added per frame
+	memcpy(&frame[XDP_KLV_OFFSET], packetTemplate, packetLength);
+	memset(&frame[XDP_KLV_OFFSET + packetLength - 2], 0, 2);
+	memset(&frame[XDP_KLV_OFFSET + motionOffset], 0, motionLength);
+	memset(&frame[XDP_KLV_OFFSET + vmtiOffset], 0, vmtiSetLength);
+	// Expression and behavior fields are outside those, the payload is summed whole then
+	if (exprFieldCount > 0 || behaviorPlatforms > 0) memset(&frame[XDP_KLV_OFFSET], 0, packetLength);
+
+	xdpUdpBase = sumBytesAt((unsigned char *)&ip.saddr, 4, 0) + sumBytesAt((unsigned char *)&dstAddr, 4, 0) +
+			IPPROTO_UDP + udpLength + sumBytesAt(&frame[XDP_UDP_OFFSET], udpLength, 0);
+}
+
+//--------------------------------------------------
+// Updates the UDP checksum of a frame whose KLV payload has been restamped
+void xdpPatchFrame(unsigned char *frame) {
+	unsigned char *klv = &frame[XDP_KLV_OFFSET];
+	uint16_t udpSum;
+
+	if (exprFieldCount > 0 || behaviorPlatforms > 0) udpSum = foldChecksum(xdpUdpBase + sumBytesAt(klv, packetLength, 8));
+	else {
+		udpSum = foldChecksum(xdpUdpBase + sumBytesAt(&klv[timestampOffset], 8, 8 + timestampOffset) +
+				sumBytesAt(&klv[motionOffset], motionLength, 8 + motionOffset) +
+				sumBytesAt(&klv[vmtiOffset], vmtiSetLength, 8 + vmtiOffset) +
+				sumBytesAt(&klv[packetLength - 2], 2, 8 + packetLength - 2));
+	}
+	if (udpSum == 0) udpSum = 0xFFFF;
+	udpSum = htons(udpSum);
+	memcpy(&frame[XDP_UDP_OFFSET + 6], &udpSum, 2);
+}
+
+//--------------------------------------------------
+// Maps one of the socket's rings into memory
+int xdpMapRing(struct xdpRing *ring, struct xdp_ring_offset *off, size_t descSize, off_t pgoff) {
+	char *map = mmap(NULL, off->desc + XDP_RING_SIZE * descSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, sock, pgoff);
+	if (map == MAP_FAILED) {
+		perror("Unable to map XDP ring");
+		return -1;
+	}
+	ring->producer = (uint32_t *)(map + off->producer);
+	ring->consumer = (uint32_t *)(map + off->consumer);
+	ring->descs = map + off->desc;
+	ring->size = XDP_RING_SIZE;
+	ring->mask = XDP_RING_SIZE - 1;
+	return 0;
+}
+
+//--------------------------------------------------
+// Initialize AF_XDP socket, UMEM and rings, bound in copy mode to xdpInterface
+int xdpInit(void) {
+	struct xdp_umem_reg umemReg;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	socklen_t optlen = sizeof(off);
+	unsigned int ringSize = XDP_RING_SIZE;
+	unsigned int ifindex;
+	uint32_t i;
+
+	ifindex = if_nametoindex(xdpInterface);
+	if (ifindex == 0) {
+		perror("Unable to find XDP interface");
+		return -1;
+	}
+	if (xdpReadInterface() == -1) return -1;
+	if (XDP_KLV_OFFSET + packetLength > XDP_FRAME_SIZE) {
+		printf("ERROR: %d byte packets do not fit in a %d byte XDP frame\n", packetLength, XDP_FRAME_SIZE);
+		return -1;
+	}
+
+	sock = socket(AF_XDP, SOCK_RAW, 0);
+	if (sock < 0) {
+		perror("Unable to create XDP socket.");
+		return -1;
+	}
+	if (posix_memalign((void **)&xdpUmem, getpagesize(), XDP_FRAME_COUNT * XDP_FRAME_SIZE) != 0) {
+		printf("ERROR: Unable to allocate XDP UMEM\n");
+		return -1;
+	}
+	memset(&umemReg, 0, sizeof(umemReg));
+	umemReg.addr = (uintptr_t)xdpUmem;
+	umemReg.len = XDP_FRAME_COUNT * XDP_FRAME_SIZE;
+	umemReg.chunk_size = XDP_FRAME_SIZE;
+	if (setsockopt(sock, SOL_XDP, XDP_UMEM_REG, &umemReg, sizeof(umemReg)) != 0) {
+		perror("Unable to register XDP UMEM");
+		return -1;
+	}
+	// The kernel requires a fill ring even though nothing is received
+	if (setsockopt(sock, SOL_XDP, XDP_UMEM_FILL_RING, &ringSize, sizeof(ringSize)) != 0 ||
+			setsockopt(sock, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ringSize, sizeof(ringSize)) != 0 ||
+			setsockopt(sock, SOL_XDP, XDP_TX_RING, &ringSize, sizeof(ringSize)) != 0) {
+		perror("Unable to size XDP rings");
+		return -1;
+	}
+	if (getsockopt(sock, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0) {
+		perror("Unable to read XDP ring offsets");
+		return -1;
+	}
+	if (xdpMapRing(&xdpTx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) == -1 ||
+			xdpMapRing(&xdpFill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) == -1 ||
+			xdpMapRing(&xdpCompletion, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) == -1) {
+		return -1;
+	}
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = xdpQueue;
+	sxdp.sxdp_flags = XDP_COPY;
+	if (bind(sock, (struct sockaddr *)&sxdp, sizeof(sxdp)) != 0) {
+		perror("Unable to bind XDP socket");
+		return -1;
+	}
+
+	xdpBuildTemplate(xdpUmem);
+	for (i = 0; i < XDP_FRAME_COUNT; ++i) {
+		if (i > 0) memcpy(&xdpUmem[i * XDP_FRAME_SIZE], xdpUmem, XDP_KLV_OFFSET + packetLength);
+		xdpFreeFrames[i] = (uint64_t)i * XDP_FRAME_SIZE;
+	}
+	xdpFreeCount = XDP_FRAME_COUNT;
+	return 0;
+}
+
+//--------------------------------------------------
+// Returns frames the kernel has finished sending to the free list
+void xdpReclaim(void) {
+	uint64_t *addrs = xdpCompletion.descs;
+	uint32_t prod = __atomic_load_n(xdpCompletion.producer, __ATOMIC_ACQUIRE);
+	uint32_t cons = *xdpCompletion.consumer;
+
+	while (cons != prod) {
+		xdpFreeFrames[xdpFreeCount++] = addrs[cons & xdpCompletion.mask];
+		cons++;
+	}
+	__atomic_store_n(xdpCompletion.consumer, cons, __ATOMIC_RELEASE);
+}
+
+//--------------------------------------------------
+// Queues up to count frames stamped with the current time and kicks the
+// kernel to transmit them. Returns the number of frames queued, or -1.
+int xdpSendBatch(uint32_t count) {
+	struct xdp_desc *descs = xdpTx.descs;
+	unsigned char *slots[PACKET_BATCH_MAX];
+	uint64_t times[PACKET_BATCH_MAX];
+	uint64_t now = clockModelTime(0, updateTimestamp());
+	uint32_t prod, cons, n, i;
+
+	xdpReclaim();
+	prod = *xdpTx.producer;
+	cons = __atomic_load_n(xdpTx.consumer, __ATOMIC_ACQUIRE);
+	n = xdpTx.size - (prod - cons);
+	if (n > count) n = count;
+	if (n > xdpFreeCount) n = xdpFreeCount;
+	if (n > PACKET_BATCH_MAX) n = PACKET_BATCH_MAX;
+
+	for (i = 0; i < n; ++i) {
+		struct xdp_desc *desc = &descs[(prod + i) & xdpTx.mask];
+		desc->addr = xdpFreeFrames[--xdpFreeCount];
+		desc->len = XDP_KLV_OFFSET + packetLength;
+		desc->options = 0;
+		slots[i] = &xdpUmem[desc->addr + XDP_KLV_OFFSET];
+		times[i] = now;
+	}
+	// A full ring or free list leaves nothing to build this time
+	if (n > 0) makePacketBatch(slots, times, NULL, n);
+	for (i = 0; i < n; ++i)
+		xdpPatchFrame(slots[i] - XDP_KLV_OFFSET);
+	__atomic_store_n(xdpTx.producer, prod + n, __ATOMIC_RELEASE);
+
+	// Copy mode transmits a limited number of descriptors per syscall
+	for (i = 0; i < n || i == 0; i += XDP_KICK_SIZE) {
+		if (sendto(sock, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1 &&
+				errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+			perror("Error sending XDP frames");
+			return -1;
+		}
+	}
+	xdpPacketsSent += n;
+	return n;
+}
+
+//--------------------------------------------------
+// Transmit loop for the XDP backend, a rate of 0 sends as fast as possible,
+// a bit rate paces batches by their size on the wire
+void xdpRun(void) {
+	struct ratePacer pacer;
+	struct byteBucket bucket;
+	int n;
+
+	if (bitRate > 0) {
+		// A full ring queues less than n, the link is already saturated then
+		n = bitRateBatch(packetLength);
+		byteBucketStart(&bucket, streamStartTime(0), n * wireBytes(packetLength));
+		while (1) {
+			byteBucketTake(&bucket, n * wireBytes(packetLength));
+			if (xdpSendBatch(n) == -1) exitProgram();
+		}
+	}
+	if (sendRate <= 0) {
+		sleepUntil(streamStartTime(0));
+		while (1) {
+			if (xdpSendBatch(PACKET_BATCH_MAX) == -1) exitProgram();
+		}
+	}
+	ratePacerInit(&pacer);
+	while (1) {
+		sleepUntil(pacer.deadline);
+		ratePacerNext(&pacer);
+		if (xdpSendBatch(1) == -1) exitProgram();
+	}
+}
+#endif